@@ -0,0 +1,384 @@
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+
+#include <json/json.h>
+
+#include "build_cache.hpp"
+#include "file_utils.hpp"
+#include "preprocessor.hpp"
+#include "section_compressor.hpp"
+#include "shader_corpus.hpp"
+#include "source_scanner.hpp"
+
+#ifdef LV_SHADER_COMPILER_BENCH_MSL
+#include "cross_compiler.hpp"
+#endif
+
+namespace nh = nlohmann;
+
+struct BenchOptions {
+    CorpusOptions corpus;
+    uint32_t iterations = 10;
+    //shader_compiler binary for the end-to-end runs, they are skipped without one
+    std::string compilerPath;
+    std::string outputPath;
+};
+
+//Runs `body` once to warm up, then `iterations` times. `bytes` is the amount of input processed per iteration, 0 if
+//throughput doesn't make sense for the benchmark.
+nh::json runBenchmark(const std::string& name, uint32_t iterations, size_t bytes, const std::function<void()>& body) {
+    body();
+
+    double total = 0.0, min = 0.0, max = 0.0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        total += ms;
+        min = (i == 0 ? ms : std::min(min, ms));
+        max = std::max(max, ms);
+    }
+
+    nh::json result;
+    result["name"] = name;
+    result["iterations"] = iterations;
+    result["meanMs"] = total / iterations;
+    result["minMs"] = min;
+    result["maxMs"] = max;
+    if (bytes > 0)
+        result["mbPerSecond"] = (double)bytes / (1024.0 * 1024.0) / (min / 1000.0);
+
+    return result;
+}
+
+//Stands in for `xcrun metal` and `xcrun metallib` on machines without Xcode. Inputs are concatenated into the output,
+//without one every input is copied to <stem>.air in the current directory, like the batched metal compile does:
+//  stub_tool.sh [-c] <inputs> -o <output>
+//  stub_tool.sh -c <inputs>
+bool writeStubTool(const std::string& path) {
+    const char* script =
+        "#!/bin/sh\n"
+        "inputs=\"\"\n"
+        "output=\"\"\n"
+        "while [ $# -gt 0 ]; do\n"
+        "    case \"$1\" in\n"
+        "        -c) ;;\n"
+        "        -o) output=\"$2\"; shift ;;\n"
+        "        *) inputs=\"$inputs $1\" ;;\n"
+        "    esac\n"
+        "    shift\n"
+        "done\n"
+        "if [ -n \"$output\" ]; then\n"
+        "    cat $inputs > \"$output\"\n"
+        "else\n"
+        "    for input in $inputs; do cp \"$input\" \"$(basename \"${input%.*}\").air\"; done\n"
+        "fi\n";
+    if (!writeFileBytes(path.c_str(), script, strlen(script)))
+        return false;
+
+    std::error_code error;
+    std::filesystem::permissions(path, std::filesystem::perms::owner_exec, std::filesystem::perm_options::add, error);
+
+    return !error;
+}
+
+void benchmarkPreprocessor(const std::vector<CorpusShader>& corpus, size_t corpusBytes, uint32_t iterations, nh::json& results) {
+    //The output buffers are reused across shaders, the same way a worker reuses them
+    PreprocessedSource output;
+    results.push_back(runBenchmark("preprocessGlslShader", iterations, corpusBytes, [&]() {
+        for (auto& shader : corpus)
+            preprocessGlslShader(shader.source, output);
+    }));
+}
+
+#ifdef LV_SHADER_COMPILER_BENCH_MSL
+//Cross compilation and reflection on SPIR-V built up front by the fake frontend, so only spirv_cross is measured
+void benchmarkCrossCompile(const std::vector<CorpusShader>& corpus, uint32_t iterations, nh::json& results) {
+    FakeGlslFrontend frontend;
+    PreprocessedSource preprocessed;
+    std::vector<std::vector<uint32_t>> fixtures;
+    std::string errors;
+    for (auto& shader : corpus) {
+        preprocessGlslShader(shader.source, preprocessed);
+        fixtures.emplace_back();
+        frontend.compile({preprocessed.metalSource, shader.stage, shader.filename, "", ""}, fixtures.back(), errors);
+    }
+
+    //MSL alone and all three targets from a single parse
+    BuildTrace trace;
+    CrossCompileOptions mslOnly;
+    results.push_back(runBenchmark("crossCompileSpirv.msl", iterations, 0, [&]() {
+        for (size_t i = 0; i < fixtures.size(); i++)
+            crossCompileSpirv(fixtures[i], mslOnly, trace, corpus[i].filename);
+    }));
+
+    CrossCompileOptions allTargets;
+    allTargets.glsl.enabled = true;
+    allTargets.hlsl.enabled = true;
+    results.push_back(runBenchmark("crossCompileSpirv.msl_glsl_hlsl", iterations, 0, [&]() {
+        for (size_t i = 0; i < fixtures.size(); i++)
+            crossCompileSpirv(fixtures[i], allTargets, trace, corpus[i].filename);
+    }));
+}
+#endif
+
+void benchmarkManifest(const std::string& corpusDir, const std::vector<CorpusShader>& corpus, uint32_t iterations, nh::json& results) {
+    auto relPath = [](const CorpusShader& shader) {
+        const char* stageDirs[] = {"vertex", "fragment", "compute"};
+        return std::string("source/") + stageDirs[(int)shader.stage] + "/" + shader.filename;
+    };
+
+    //Cold: every source is read and hashed. Warm: the stamps match, so only stat is called.
+    BuildManifest manifest;
+    manifest.rootDir = corpusDir;
+    results.push_back(runBenchmark("manifest.computeShaderKey.cold", iterations, 0, [&]() {
+        manifest.files.clear();
+        manifest.shaders.clear();
+        for (auto& shader : corpus) {
+            ShaderRecord record;
+            manifest.computeShaderKey(relPath(shader), (uint32_t)shader.stage, 0, record);
+            manifest.shaders[relPath(shader)] = std::move(record);
+        }
+    }));
+    results.push_back(runBenchmark("manifest.computeShaderKey.warm", iterations, 0, [&]() {
+        for (auto& shader : corpus) {
+            ShaderRecord record;
+            manifest.computeShaderKey(relPath(shader), (uint32_t)shader.stage, 0, record);
+        }
+    }));
+
+    std::string manifestPath = corpusDir + "/bench_manifest";
+    results.push_back(runBenchmark("manifest.save", iterations, 0, [&]() {
+        manifest.save(manifestPath);
+    }));
+    BuildManifest loaded;
+    results.push_back(runBenchmark("manifest.load", iterations, 0, [&]() {
+        loaded.load(manifestPath);
+    }));
+}
+
+//Source tree of a large project: SCAN_DIRECTORY_COUNT nested directories with SCAN_FILES_PER_DIRECTORY empty files each.
+//Cold lists every directory, warm only stats them against the snapshot of the previous scan.
+const uint32_t SCAN_DIRECTORY_COUNT = 200;
+const uint32_t SCAN_FILES_PER_DIRECTORY = 50;
+
+void benchmarkScanner(const std::string& corpusDir, uint32_t iterations, nh::json& results) {
+    std::error_code error;
+    for (uint32_t dir = 0; dir < SCAN_DIRECTORY_COUNT; dir++) {
+        std::string dirPath = corpusDir + "/scan/group" + std::to_string(dir % 10) + "/dir" + std::to_string(dir);
+        std::filesystem::create_directories(dirPath, error);
+        for (uint32_t file = 0; file < SCAN_FILES_PER_DIRECTORY; file++)
+            writeFileBytes((dirPath + "/shader" + std::to_string(file) + ".frag").c_str(), "", 0);
+    }
+
+    SourceScanner scanner;
+    scanner.rootDir = corpusDir;
+    std::vector<std::string> files;
+    results.push_back(runBenchmark("scanner.scan.cold", iterations, 0, [&]() {
+        scanner.directories.clear();
+        scanner.scan("scan", files);
+    }));
+    //Snapshot entries are only trusted once the directories are older than the racy window
+    for (auto& [relDir, record] : scanner.directories) {
+        FileStamp stamp;
+        getFileStamp(corpusDir + "/" + relDir, stamp);
+        record.mtime = stamp.mtime;
+    }
+    results.push_back(runBenchmark("scanner.scan.warm", iterations, 0, [&]() {
+        scanner.scan("scan", files);
+    }));
+}
+
+//Compression ratio against decode speed, with and without a dictionary trained on the same sections. The fake
+//frontend's SPIR-V stands in for the SPIR-V sections, the corpus sources for the cross compiled ones. Every section is
+//streamed through a SectionDecoder into a buffer big enough for the largest, the way a loader would reuse it.
+void benchmarkCompression(const std::vector<CorpusShader>& corpus, uint32_t iterations, nh::json& results) {
+    FakeGlslFrontend frontend;
+    PreprocessedSource preprocessed;
+    std::vector<std::string> spirvSections, glslSections;
+    std::string errors;
+    for (auto& shader : corpus) {
+        preprocessGlslShader(shader.source, preprocessed);
+        std::vector<uint32_t> spirv;
+        if (frontend.compile({preprocessed.metalSource, shader.stage, shader.filename, "", ""}, spirv, errors))
+            spirvSections.emplace_back(reinterpret_cast<const char*>(spirv.data()), spirv.size() * sizeof(uint32_t));
+        glslSections.push_back(shader.source);
+    }
+
+    for (auto& [name, sections] : {std::make_pair("spirv", &spirvSections), std::make_pair("glsl", &glslSections)}) {
+        std::vector<std::string_view> samples(sections->begin(), sections->end());
+        std::string dictionary = trainDictionary(samples);
+        for (bool useDictionary : {false, true}) {
+            SectionCompressor compressor(useDictionary ? std::string_view(dictionary) : std::string_view());
+            std::vector<std::string> compressed;
+            size_t uncompressedBytes = 0, compressedBytes = 0, largest = 0;
+            for (auto& section : *sections) {
+                compressed.push_back(compressor.compress(section.data(), section.size()));
+                uncompressedBytes += section.size();
+                compressedBytes += compressed.back().size();
+                largest = std::max(largest, section.size());
+            }
+
+            std::string buffer(largest, '\0');
+            nh::json result = runBenchmark("compression." + std::string(name) + (useDictionary ? ".lz4_dictionary" : ".lz4"), iterations, uncompressedBytes, [&]() {
+                lv::SectionDecoder decoder;
+                for (auto& data : compressed) {
+                    decoder.open(data.data(), data.size(), true, dictionary.data(), dictionary.size());
+                    decoder.readAll(buffer.data());
+                }
+            });
+            result["ratio"] = (double)compressedBytes / (double)std::max<size_t>(uncompressedBytes, 1);
+            if (useDictionary)
+                result["dictionarySize"] = dictionary.size();
+            results.push_back(result);
+        }
+    }
+}
+
+//Runs the real compiler with the fake frontend and the stub Metal tools. The first run builds everything,
+//the measured runs find nothing to do, which is the common case of a build system invoking the compiler.
+void benchmarkEndToEnd(const std::string& compilerPath, const std::string& corpusDir, const std::string& name, const std::string& extraArgs, uint32_t iterations, nh::json& results) {
+    std::string stubTool = corpusDir + "/stub_tool.sh";
+    if (!writeStubTool(stubTool)) {
+        std::cerr << "Could not write '" << stubTool << "', skipping the end-to-end benchmarks" << std::endl;
+        return;
+    }
+
+    std::string command = "\"" + compilerPath + "\" --frontend fake --metal \"" + stubTool + "\" --metallib \"" + stubTool + "\" -j 0 " + extraArgs + "\"" + corpusDir + "\" > /dev/null";
+    bool failed = false;
+    auto start = std::chrono::steady_clock::now();
+    failed |= (std::system(command.c_str()) != 0);
+    double coldMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    nh::json cold;
+    cold["name"] = name + ".cold";
+    cold["iterations"] = 1;
+    cold["meanMs"] = cold["minMs"] = cold["maxMs"] = coldMs;
+    results.push_back(cold);
+
+    results.push_back(runBenchmark(name + ".noop", iterations, 0, [&]() {
+        failed |= (std::system(command.c_str()) != 0);
+    }));
+    if (failed)
+        std::cerr << "Warning: '" << compilerPath << "' failed, the end-to-end timings are not meaningful" << std::endl;
+}
+
+//Same rules as the options of shader_compiler, the whole argument has to be a number
+template<typename T>
+bool parseNumberArgument(const std::string& str, T& value) {
+    T parsed;
+    auto result = std::from_chars(str.data(), str.data() + str.size(), parsed);
+    if (result.ec != std::errc() || result.ptr != str.data() + str.size())
+        return false;
+    value = parsed;
+
+    return true;
+}
+
+void printUsage() {
+    std::cout << "Usage: shader_compiler_bench [--count N] [--size-kb N] [--seed N] [--iterations N] [--compiler path] [--output file]\n"
+                 "       shader_compiler_bench --generate <directory> [--count N] [--size-kb N] [--seed N]" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    std::string generateDir;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (i + 1 >= argc) {
+            printUsage();
+            return 1;
+        }
+
+        std::string value(argv[++i]);
+        bool validNumber = true;
+        if (arg == "--count")
+            validNumber = parseNumberArgument(value, options.corpus.shaderCount);
+        else if (arg == "--size-kb")
+            validNumber = parseNumberArgument(value, options.corpus.shaderSizeKB);
+        else if (arg == "--seed")
+            validNumber = parseNumberArgument(value, options.corpus.seed);
+        else if (arg == "--iterations")
+            validNumber = parseNumberArgument(value, options.iterations);
+        else if (arg == "--compiler")
+            options.compilerPath = value;
+        else if (arg == "--output")
+            options.outputPath = value;
+        else if (arg == "--generate")
+            generateDir = value;
+        else {
+            printUsage();
+            return 1;
+        }
+
+        if (!validNumber) {
+            std::cout << "Option '" << arg << "' expects a number, got '" << value << "'" << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+    options.iterations = std::max<uint32_t>(options.iterations, 1);
+
+    std::vector<CorpusShader> corpus = generateShaderCorpus(options.corpus);
+    if (!generateDir.empty()) {
+        if (!writeShaderCorpus(generateDir, corpus)) {
+            std::cerr << "Could not write the corpus to '" << generateDir << "'" << std::endl;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    size_t corpusBytes = 0;
+    for (auto& shader : corpus)
+        corpusBytes += shader.source.size();
+
+    std::string corpusDir = (std::filesystem::temp_directory_path() / ("lava_shader_bench_" + std::to_string(options.corpus.seed))).string();
+    std::error_code error;
+    std::filesystem::remove_all(corpusDir, error);
+    if (!writeShaderCorpus(corpusDir, corpus)) {
+        std::cerr << "Could not write the corpus to '" << corpusDir << "'" << std::endl;
+        return 1;
+    }
+
+    nh::json report;
+    report["corpus"]["seed"] = options.corpus.seed;
+    report["corpus"]["shaderCount"] = options.corpus.shaderCount;
+    report["corpus"]["shaderSizeKB"] = options.corpus.shaderSizeKB;
+    report["corpus"]["bytes"] = corpusBytes;
+
+    nh::json& results = report["benchmarks"] = nh::json::array();
+    benchmarkPreprocessor(corpus, corpusBytes, options.iterations, results);
+#ifdef LV_SHADER_COMPILER_BENCH_MSL
+    benchmarkCrossCompile(corpus, options.iterations, results);
+#endif
+    benchmarkManifest(corpusDir, corpus, options.iterations, results);
+    benchmarkScanner(corpusDir, options.iterations, results);
+    benchmarkCompression(corpus, options.iterations, results);
+    //The batched run changes the settings, so its cold build really starts from scratch too
+    if (!options.compilerPath.empty()) {
+        benchmarkEndToEnd(options.compilerPath, corpusDir, "shader_compiler", "", options.iterations, results);
+        benchmarkEndToEnd(options.compilerPath, corpusDir, "shader_compiler.batchMetal", "--batch-metal ", options.iterations, results);
+    }
+
+    std::filesystem::remove_all(corpusDir, error);
+
+    //Keys are sorted and the benchmarks always run in the same order, so reports of two commits diff cleanly
+    std::string json = report.dump(4) + "\n";
+    if (options.outputPath.empty()) {
+        std::cout << json;
+    } else if (!writeFileBytes(options.outputPath.c_str(), json.data(), json.size())) {
+        std::cerr << "Could not write '" << options.outputPath << "'" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
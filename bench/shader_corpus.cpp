@@ -0,0 +1,155 @@
+#include "shader_corpus.hpp"
+
+#include <filesystem>
+
+#include "file_utils.hpp"
+
+namespace {
+
+//SplitMix64, fully specified, so the corpus is identical on every platform and standard library
+class CorpusRandom {
+public:
+    explicit CorpusRandom(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+        return z ^ (z >> 31);
+    }
+
+    //Inclusive range
+    uint32_t range(uint32_t min, uint32_t max) {
+        return min + (uint32_t)(next() % (max - min + 1));
+    }
+
+private:
+    uint64_t state;
+};
+
+const char* stageDirectoryName(ShaderStage stage) {
+    switch (stage) {
+    case ShaderStage::Vertex:
+        return "vertex";
+    case ShaderStage::Fragment:
+        return "fragment";
+    case ShaderStage::Compute:
+        return "compute";
+    }
+
+    return "unknown";
+}
+
+const char* stageExtension(ShaderStage stage) {
+    switch (stage) {
+    case ShaderStage::Vertex:
+        return ".vert";
+    case ShaderStage::Fragment:
+        return ".frag";
+    case ShaderStage::Compute:
+        return ".comp";
+    }
+
+    return "";
+}
+
+std::string generateShader(ShaderStage stage, size_t targetSize, CorpusRandom& random) {
+    std::string source = "#version 450\n#include \"lava_common.glsl\"\n\n";
+    source.reserve(targetSize + 1024);
+
+    if (random.range(0, 1) == 0)
+        source += "layout(push_constant) uniform PushConstants {\n    float4x4 model;\n} pc;\n\n";
+
+    //Bindings are handed out densely per set, like a real pipeline layout would
+    uint32_t nextBinding[4] = {0, 0, 0, 0};
+    auto binding = [&](uint32_t set) {
+        return "set = " + std::to_string(set) + ", binding = " + std::to_string(nextBinding[set]++);
+    };
+
+    if (stage == ShaderStage::Vertex) {
+        uint32_t attributeCount = random.range(2, 6);
+        for (uint32_t i = 0; i < attributeCount; i++)
+            source += "layout(location = " + std::to_string(i) + ") in float4 inAttribute" + std::to_string(i) + ";\n";
+    } else if (stage == ShaderStage::Fragment) {
+        //Color attachments are remapped for Metal, input attachments always point at one of them
+        uint32_t colorCount = random.range(1, 4);
+        for (uint32_t i = 0; i < colorCount; i++)
+            source += "layout(location = " + std::to_string(i) + ", color_attachment_index = " + std::to_string(random.range(0, 7)) + ") out float4 outColor" + std::to_string(i) + ";\n";
+        uint32_t inputCount = random.range(0, 3);
+        for (uint32_t i = 0; i < inputCount; i++)
+            source += "layout(input_attachment_index = " + std::to_string(i) + ", color_attachment_index = " + std::to_string(random.range(0, 7)) + ", " + binding(0) + ") uniform subpassInput inputAttachment" + std::to_string(i) + ";\n";
+    }
+    source += "\n";
+
+    uint32_t resourceCount = random.range(4, 24);
+    for (uint32_t i = 0; i < resourceCount; i++) {
+        uint32_t set = random.range(0, 3);
+        std::string index = std::to_string(i);
+        switch (random.range(0, stage == ShaderStage::Compute ? 3 : 2)) {
+        case 0:
+            source += "layout(" + binding(set) + ") uniform UniformBuffer" + index + " {\n    float4x4 viewProj;\n    float4 params;\n} ubo" + index + ";\n";
+            break;
+        case 1:
+            source += "layout(" + binding(set) + ") buffer StorageBuffer" + index + " {\n    float4 data[];\n} ssbo" + index + ";\n";
+            break;
+        case 2:
+            source += "layout(" + binding(set) + ") uniform sampler2D texture" + index + ";\n";
+            break;
+        case 3:
+            source += "layout(" + binding(set) + ", rgba8) uniform image2D image" + index + ";\n";
+            break;
+        }
+    }
+    source += "\n";
+
+    //Filler code with comments, so the preprocessor has realistic text to skip over
+    uint32_t function = 0;
+    while (source.size() < targetSize) {
+        std::string index = std::to_string(function++);
+        source += "// location = " + index + ", color_attachment_index = " + index + " is only a comment\n";
+        source += "float4 shade" + index + "(float4 color, half4 tint) {\n";
+        source += "    /* float4 unused = float4(0.0); */\n";
+        source += "    float3x3 basis = float3x3(1.0);\n";
+        source += "    return color * float4(basis * color.xyz, 1.0) + float4(tint) * " + std::to_string(random.range(1, 1000)) + ".0;\n}\n\n";
+    }
+    source += "void main() {}\n";
+
+    return source;
+}
+
+} //namespace
+
+std::vector<CorpusShader> generateShaderCorpus(const CorpusOptions& options) {
+    CorpusRandom random(options.seed);
+    std::vector<CorpusShader> corpus;
+    corpus.reserve(options.shaderCount);
+    for (uint32_t i = 0; i < options.shaderCount; i++) {
+        ShaderStage stage = (ShaderStage)(i % 3);
+        CorpusShader shader;
+        shader.stage = stage;
+        shader.filename = "shader" + std::to_string(i) + stageExtension(stage);
+        shader.source = generateShader(stage, options.shaderSizeKB * 1024, random);
+        corpus.push_back(std::move(shader));
+    }
+
+    return corpus;
+}
+
+bool writeShaderCorpus(const std::string& directory, const std::vector<CorpusShader>& corpus) {
+    std::error_code error;
+    for (ShaderStage stage : {ShaderStage::Vertex, ShaderStage::Fragment, ShaderStage::Compute}) {
+        std::filesystem::create_directories(directory + "/source/" + stageDirectoryName(stage), error);
+        std::filesystem::create_directories(directory + "/compiled/" + stageDirectoryName(stage), error);
+        if (error)
+            return false;
+    }
+
+    for (auto& shader : corpus) {
+        std::string path = directory + "/source/" + stageDirectoryName(shader.stage) + "/" + shader.filename;
+        if (!writeFileBytes(path.c_str(), shader.source.data(), shader.source.size()))
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef LV_SHADER_CORPUS_H
+#define LV_SHADER_CORPUS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "frontend.hpp"
+
+struct CorpusOptions {
+    uint64_t seed = 1;
+    uint32_t shaderCount = 64;
+    size_t shaderSizeKB = 16;
+};
+
+struct CorpusShader {
+    ShaderStage stage;
+    std::string filename;
+    std::string source;
+};
+
+//Synthetic GLSL shaders in the dialect the compiler accepts: lava_common.glsl types, attachments with
+//"location = N, color_attachment_index = M", input attachments and many descriptor bindings. The same options
+//always produce the same corpus, the generator doesn't depend on the standard library's random distributions.
+std::vector<CorpusShader> generateShaderCorpus(const CorpusOptions& options);
+
+//Lays the corpus out the way the compiler expects it: <directory>/source/{vertex,fragment,compute}
+bool writeShaderCorpus(const std::string& directory, const std::vector<CorpusShader>& corpus);
+
+#endif
@@ -0,0 +1,476 @@
+#include "build_cache.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <unordered_set>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "hash.hpp"
+
+namespace fs = std::filesystem;
+
+const char* MANIFEST_MAGIC = "lava_shader_manifest";
+
+bool getFileStamp(const std::string& path, FileStamp& stamp) {
+    struct stat result;
+    if (stat(path.c_str(), &result) != 0)
+        return false;
+
+    stamp.size = (uint64_t)result.st_size;
+#if defined(__APPLE__)
+    stamp.mtime = (int64_t)result.st_mtimespec.tv_sec * 1000000000 + result.st_mtimespec.tv_nsec;
+#elif defined(WIN32)
+    stamp.mtime = (int64_t)result.st_mtime * 1000000000;
+#else
+    stamp.mtime = (int64_t)result.st_mtim.tv_sec * 1000000000 + result.st_mtim.tv_nsec;
+#endif
+
+    return true;
+}
+
+static bool readWholeFile(const std::string& path, std::string& content) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    return true;
+}
+
+//Splits off the next space separated token
+static std::string_view nextToken(std::string_view& line) {
+    size_t end = line.find(' ');
+    std::string_view token = line.substr(0, end);
+    line = (end == std::string_view::npos ? std::string_view() : line.substr(end + 1));
+
+    return token;
+}
+
+template<typename T>
+static bool parseNumber(std::string_view token, T& value, int base = 10) {
+    auto result = std::from_chars(token.data(), token.data() + token.size(), value, base);
+
+    return result.ec == std::errc() && result.ptr == token.data() + token.size();
+}
+
+bool BuildManifest::load(const std::string& path) {
+    files.clear();
+    shaders.clear();
+
+    std::string content;
+    if (!readWholeFile(path, content))
+        return false;
+
+    std::string_view text(content);
+    ShaderRecord* currentShader = nullptr;
+    bool headerRead = false;
+    while (!text.empty()) {
+        size_t lineEnd = text.find('\n');
+        std::string_view line = text.substr(0, lineEnd);
+        text = (lineEnd == std::string_view::npos ? std::string_view() : text.substr(lineEnd + 1));
+        if (line.empty())
+            continue;
+
+        std::string_view type = nextToken(line);
+        if (!headerRead) {
+            uint32_t version = 0;
+            if (type != MANIFEST_MAGIC || !parseNumber(nextToken(line), version) || version != BUILD_CACHE_VERSION)
+                return false;
+            headerRead = true;
+        } else if (type == "f") {
+            FileRecord record;
+            if (!parseNumber(nextToken(line), record.hash, 16) ||
+                !parseNumber(nextToken(line), record.stamp.size) ||
+                !parseNumber(nextToken(line), record.stamp.mtime))
+                return false;
+            files[std::string(line)] = record;
+        } else if (type == "s") {
+            ShaderRecord record;
+            size_t includeCount = 0;
+            if (!parseNumber(nextToken(line), record.key, 16) ||
+                !parseNumber(nextToken(line), record.sourceHash, 16) ||
+                !parseNumber(nextToken(line), includeCount))
+                return false;
+            record.includes.reserve(includeCount);
+            currentShader = &(shaders[std::string(line)] = std::move(record));
+        } else if (type == "i" && currentShader) {
+            IncludeRecord include;
+            if (!parseNumber(nextToken(line), include.hash, 16))
+                return false;
+            include.path = line;
+            currentShader->includes.push_back(std::move(include));
+        } else {
+            return false;
+        }
+    }
+
+    return headerRead;
+}
+
+bool BuildManifest::save(const std::string& path) const {
+    std::string out;
+    out.reserve(64 * (files.size() + shaders.size()));
+    out += MANIFEST_MAGIC;
+    out += " " + std::to_string(BUILD_CACHE_VERSION) + "\n";
+    for (auto& [filePath, record] : files) {
+        if (!record.seen)
+            continue;
+        out += "f " + hashToHex(record.hash) + " " + std::to_string(record.stamp.size) + " " + std::to_string(record.stamp.mtime) + " " + filePath + "\n";
+    }
+    for (auto& [shaderPath, record] : shaders) {
+        if (!record.seen)
+            continue;
+        out += "s " + hashToHex(record.key) + " " + hashToHex(record.sourceHash) + " " + std::to_string(record.includes.size()) + " " + shaderPath + "\n";
+        for (auto& include : record.includes)
+            out += "i " + hashToHex(include.hash) + " " + include.path + "\n";
+    }
+
+    //Write to a temporary file first, so an interrupted run never leaves a truncated manifest behind
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+        file.write(out.data(), out.size());
+        if (!file)
+            return false;
+    }
+
+    std::error_code error;
+    fs::rename(tempPath, path, error);
+
+    return !error;
+}
+
+std::string BuildManifest::relativePath(const std::string& path) const {
+    fs::path normalized = fs::path(path).lexically_normal();
+    fs::path relative = normalized.lexically_relative(fs::path(rootDir).lexically_normal());
+    if (relative.empty() || *relative.begin() == "..")
+        return fs::absolute(normalized).lexically_normal().generic_string();
+
+    return relative.generic_string();
+}
+
+std::string BuildManifest::absolutePath(const std::string& relPath) const {
+    if (fs::path(relPath).is_absolute())
+        return relPath;
+
+    return rootDir + "/" + relPath;
+}
+
+bool BuildManifest::readAndHash(const std::string& relPath, FileRecord& record, std::string* content) {
+    std::string fileContent;
+    if (!getFileStamp(absolutePath(relPath), record.stamp) || !readWholeFile(absolutePath(relPath), fileContent))
+        return false;
+
+    record.hash = hashString(fileContent);
+    record.seen = true;
+    if (content)
+        *content = std::move(fileContent);
+
+    return true;
+}
+
+bool BuildManifest::hashFile(const std::string& relPath, uint64_t& hash) {
+    FileStamp stamp;
+    if (!getFileStamp(absolutePath(relPath), stamp))
+        return false;
+
+    FileRecord& record = files[relPath];
+    if (record.hash == 0 || !(record.stamp == stamp)) {
+        if (!readAndHash(relPath, record, nullptr))
+            return false;
+    }
+    record.seen = true;
+    hash = record.hash;
+
+    return true;
+}
+
+std::vector<std::string> parseIncludeDirectives(std::string_view source) {
+    std::vector<std::string> includes;
+    size_t pos = 0;
+    while (pos < source.size()) {
+        size_t lineEnd = source.find('\n', pos);
+        if (lineEnd == std::string_view::npos)
+            lineEnd = source.size();
+        std::string_view line = source.substr(pos, lineEnd - pos);
+        pos = lineEnd + 1;
+
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string_view::npos || line[start] != '#')
+            continue;
+        start = line.find_first_not_of(" \t", start + 1);
+        if (start == std::string_view::npos || line.substr(start, 7) != "include")
+            continue;
+        start = line.find_first_of("\"<", start + 7);
+        if (start == std::string_view::npos)
+            continue;
+        size_t end = line.find(line[start] == '"' ? '"' : '>', start + 1);
+        if (end == std::string_view::npos)
+            continue;
+
+        includes.emplace_back(line.substr(start + 1, end - start - 1));
+    }
+
+    return includes;
+}
+
+void BuildManifest::gatherIncludes(const std::string& relPath, std::string_view source, std::vector<IncludeRecord>& includes) {
+    std::string fileDir = fs::path(relPath).parent_path().generic_string();
+    for (auto& name : parseIncludeDirectives(source)) {
+        //Same lookup order as glslc: next to the including file first, then the include directories
+        std::vector<std::string> candidates;
+        candidates.push_back(fileDir.empty() ? name : fileDir + "/" + name);
+        for (auto& includeDir : includeDirs)
+            candidates.push_back(includeDir + "/" + name);
+
+        for (auto& candidate : candidates) {
+            std::string candidateRelPath = relativePath(absolutePath(fs::path(candidate).lexically_normal().generic_string()));
+            FileStamp stamp;
+            if (!getFileStamp(absolutePath(candidateRelPath), stamp))
+                continue;
+
+            bool alreadyIncluded = false;
+            for (auto& include : includes)
+                alreadyIncluded |= (include.path == candidateRelPath);
+            if (alreadyIncluded)
+                break;
+
+            FileRecord& record = files[candidateRelPath];
+            std::string includeSource;
+            if (!readAndHash(candidateRelPath, record, &includeSource))
+                break;
+            includes.push_back({candidateRelPath, record.hash});
+            gatherIncludes(candidateRelPath, includeSource, includes);
+
+            break;
+        }
+    }
+}
+
+bool BuildManifest::computeShaderKey(const std::string& relPath, uint32_t stage, uint64_t settingsHash, ShaderRecord& record) {
+    FileStamp stamp;
+    if (!getFileStamp(absolutePath(relPath), stamp))
+        return false;
+
+    std::string source;
+    bool sourceRead = false;
+    FileRecord& fileRecord = files[relPath];
+    if (fileRecord.hash == 0 || !(fileRecord.stamp == stamp)) {
+        if (!readAndHash(relPath, fileRecord, &source))
+            return false;
+        sourceRead = true;
+    }
+    fileRecord.seen = true;
+
+    record.sourceHash = fileRecord.hash;
+    record.includes.clear();
+
+    //The include set only has to be rescanned when the source or one of the included files changed
+    auto oldRecord = shaders.find(relPath);
+    bool includesValid = (oldRecord != shaders.end() && oldRecord->second.sourceHash == record.sourceHash);
+    if (includesValid) {
+        for (auto& include : oldRecord->second.includes) {
+            uint64_t includeHash;
+            if (!hashFile(include.path, includeHash) || includeHash != include.hash) {
+                includesValid = false;
+                break;
+            }
+        }
+    }
+
+    if (includesValid) {
+        record.includes = oldRecord->second.includes;
+    } else {
+        if (!sourceRead && !readWholeFile(absolutePath(relPath), source))
+            return false;
+        gatherIncludes(relPath, source, record.includes);
+    }
+
+    uint64_t key = hashCombine(BUILD_CACHE_VERSION, settingsHash);
+    key = hashCombine(key, stage);
+    key = hashCombine(key, record.sourceHash);
+    for (auto& include : record.includes) {
+        key = hashCombine(key, hashString(include.path));
+        key = hashCombine(key, include.hash);
+    }
+    record.key = key;
+    record.seen = true;
+
+    return true;
+}
+
+std::string ArtifactCache::artifactPath(uint64_t key) const {
+    std::string hex = hashToHex(key);
+
+    return dir + "/" + hex.substr(0, 2) + "/" + hex + ".lvsc";
+}
+
+//Unique across processes and machines sharing the directory
+std::string ArtifactCache::temporaryPath(const std::string& path) const {
+    static std::random_device device;
+    uint64_t suffix = ((uint64_t)device() << 32) | device();
+
+    return path + ".tmp" + hashToHex(suffix);
+}
+
+bool ArtifactCache::restore(uint64_t key, const std::string& outputPath) {
+    std::error_code error;
+    std::string path = artifactPath(key);
+    //Another build may evict the artifact at any time, a failed copy is just a miss
+    fs::copy_file(path, outputPath, fs::copy_options::overwrite_existing, error);
+    if (error) {
+        stats.misses++;
+        return false;
+    }
+
+    //atime is unreliable (noatime mounts, NFS), the mtime doubles as the last use for the LRU
+    fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+    stats.hits++;
+
+    return true;
+}
+
+bool ArtifactCache::store(uint64_t key, const std::string& outputPath) {
+    std::string path = artifactPath(key);
+    std::error_code error;
+    fs::create_directories(fs::path(path).parent_path(), error);
+
+    std::string tempPath = temporaryPath(path);
+    fs::copy_file(outputPath, tempPath, fs::copy_options::overwrite_existing, error);
+    if (error) {
+        fs::remove(tempPath, error);
+        return false;
+    }
+    //Another build may have stored the same key in the meantime, the rename then replaces it and only the difference
+    //is new in the directory
+    uint64_t oldSize = fs::file_size(path, error);
+    if (error)
+        oldSize = 0;
+    fs::rename(tempPath, path, error);
+    if (error) {
+        fs::remove(tempPath, error);
+        return false;
+    }
+    stats.stores++;
+    uint64_t newSize = fs::file_size(path, error);
+    if (!error && newSize > oldSize)
+        stats.size += newSize - oldSize;
+
+    return true;
+}
+
+uint64_t ArtifactCache::trim() {
+    struct Entry {
+        fs::file_time_type lastUse;
+        uint64_t size;
+        fs::path path;
+    };
+    std::vector<Entry> entries;
+    uint64_t totalSize = 0;
+    std::error_code error;
+    for (auto it = fs::recursive_directory_iterator(dir, error); !error && it != fs::recursive_directory_iterator(); it.increment(error)) {
+        if (!it->is_regular_file(error) || it->path().filename() == "stats")
+            continue;
+        //Temporary files from temporaryPath() belong to a build that is still writing them
+        if (it->path().extension().string().starts_with(".tmp"))
+            continue;
+
+        Entry entry{it->last_write_time(error), it->file_size(error), it->path()};
+        totalSize += entry.size;
+        entries.push_back(std::move(entry));
+    }
+    if (totalSize <= maxSize)
+        return totalSize;
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.lastUse < b.lastUse;
+    });
+    uint64_t targetSize = maxSize / 10 * 9;
+    for (auto& entry : entries) {
+        if (totalSize <= targetSize)
+            break;
+        if (fs::remove(entry.path, error)) {
+            totalSize -= entry.size;
+            stats.evictions++;
+        }
+    }
+
+    return totalSize;
+}
+
+bool ArtifactCache::loadStats(ArtifactCacheStats& totals) const {
+    totals = {};
+    std::string content;
+    if (!readWholeFile(dir + "/stats", content))
+        return false;
+
+    std::string_view text(content);
+    while (!text.empty()) {
+        size_t lineEnd = text.find('\n');
+        std::string_view line = text.substr(0, lineEnd);
+        text = (lineEnd == std::string_view::npos ? std::string_view() : text.substr(lineEnd + 1));
+
+        std::string_view name = nextToken(line);
+        uint64_t value = 0;
+        if (!parseNumber(line, value))
+            continue;
+        if (name == "hits")
+            totals.hits = value;
+        else if (name == "misses")
+            totals.misses = value;
+        else if (name == "stores")
+            totals.stores = value;
+        else if (name == "evictions")
+            totals.evictions = value;
+        else if (name == "size")
+            totals.size = value;
+    }
+
+    return true;
+}
+
+bool ArtifactCache::finishBuild() {
+    if (stats.hits == 0 && stats.misses == 0 && stats.stores == 0)
+        return true;
+
+    ArtifactCacheStats totals;
+    loadStats(totals);
+    totals.hits += stats.hits;
+    totals.misses += stats.misses;
+    totals.stores += stats.stores;
+    totals.size += stats.size;
+    if (maxSize > 0 && totals.size > maxSize) {
+        totals.size = trim();
+        totals.evictions += stats.evictions;
+    }
+
+    std::string content = "hits " + std::to_string(totals.hits) + "\n" +
+        "misses " + std::to_string(totals.misses) + "\n" +
+        "stores " + std::to_string(totals.stores) + "\n" +
+        "evictions " + std::to_string(totals.evictions) + "\n" +
+        "size " + std::to_string(totals.size) + "\n";
+    std::string path = dir + "/stats";
+    std::string tempPath = temporaryPath(path);
+    std::error_code error;
+    fs::create_directories(dir, error);
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file || !file.write(content.data(), content.size()))
+            return false;
+    }
+    fs::rename(tempPath, path, error);
+    if (error)
+        return false;
+    stats = {};
+
+    return true;
+}
@@ -0,0 +1,125 @@
+#ifndef LV_BUILD_CACHE_H
+#define LV_BUILD_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+//Bump whenever the output format or the way keys are computed changes
+const uint32_t BUILD_CACHE_VERSION = 8;
+
+struct FileStamp {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+
+    bool operator==(const FileStamp& other) const {
+        return size == other.size && mtime == other.mtime;
+    }
+};
+
+bool getFileStamp(const std::string& path, FileStamp& stamp);
+
+struct FileRecord {
+    FileStamp stamp;
+    uint64_t hash = 0;
+    bool seen = false;
+};
+
+struct IncludeRecord {
+    std::string path;
+    uint64_t hash = 0;
+};
+
+struct ShaderRecord {
+    uint64_t key = 0;
+    uint64_t sourceHash = 0;
+    //Transitive include set, in discovery order
+    std::vector<IncludeRecord> includes;
+    bool seen = false;
+};
+
+//Line based manifest, loaded and saved in a single pass without any JSON parsing. All paths are relative
+//to the shader directory, so moving the project around keeps the cache valid.
+class BuildManifest {
+public:
+    std::string rootDir;
+    std::vector<std::string> includeDirs;
+
+    std::unordered_map<std::string, FileRecord> files;
+    std::unordered_map<std::string, ShaderRecord> shaders;
+
+    bool load(const std::string& path);
+
+    bool save(const std::string& path) const;
+
+    std::string relativePath(const std::string& path) const;
+
+    std::string absolutePath(const std::string& relPath) const;
+
+    //Content hash of a file. The file is only reread when its size or mtime changed since the last run,
+    //so a touch or a checkout that does not change the contents does not trigger a rebuild.
+    bool hashFile(const std::string& relPath, uint64_t& hash);
+
+    //Hashes the source and all of its transitive includes and combines them with the settings hash
+    //(macros, toolchain, backend options) and the stage into the cache key, so the same source compiled as two
+    //stages never shares an artifact. Returns false if the source can't be read.
+    bool computeShaderKey(const std::string& relPath, uint32_t stage, uint64_t settingsHash, ShaderRecord& record);
+
+private:
+    bool readAndHash(const std::string& relPath, FileRecord& record, std::string* content);
+
+    void gatherIncludes(const std::string& relPath, std::string_view source, std::vector<IncludeRecord>& includes);
+};
+
+std::vector<std::string> parseIncludeDirectives(std::string_view source);
+
+struct ArtifactCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t stores = 0;
+    uint64_t evictions = 0;
+    //Bytes stored by this process. In the totals it is the estimated size of the directory, kept up to date by every
+    //build, so that the directory only has to be scanned when it actually grew past the limit.
+    uint64_t size = 0;
+};
+
+//Content addressed store of compiled containers, ccache style. The key only depends on the contents of the source,
+//its includes and the settings, never on absolute paths, so checkouts and CI runners can share one directory, local
+//or on NFS, without any service. Every write goes to a uniquely named temporary file that is renamed into place, so
+//concurrent builds only ever see complete artifacts.
+//
+//Layout: <dir>/<first two hex digits of the key>/<key>.lvsc and <dir>/stats. A hit bumps the mtime of the artifact,
+//so that the least recently used ones are evicted first once the directory grows past maxSize.
+class ArtifactCache {
+public:
+    std::string dir;
+    //Bytes, 0 for no limit
+    uint64_t maxSize = 0;
+
+    //Counted by this process since the last finishBuild()
+    ArtifactCacheStats stats;
+
+    std::string artifactPath(uint64_t key) const;
+
+    bool restore(uint64_t key, const std::string& outputPath);
+
+    bool store(uint64_t key, const std::string& outputPath);
+
+    //Adds the counts of this process to the totals of the directory and evicts if the estimated size went past maxSize.
+    //The totals are a read-modify-write through a rename, concurrent builds can lose each other's counts but never
+    //corrupt the file.
+    bool finishBuild();
+
+    bool loadStats(ArtifactCacheStats& totals) const;
+
+private:
+    std::string temporaryPath(const std::string& path) const;
+
+    //Evicts the least recently used artifacts down to 90% of maxSize, so that a full cache isn't scanned on every build.
+    //Returns the size left.
+    uint64_t trim();
+};
+
+#endif
@@ -0,0 +1,204 @@
+#include "cross_compiler.hpp"
+
+#include <algorithm>
+
+#include "spirv_glsl.hpp"
+#include "spirv_hlsl.hpp"
+#include "spirv_msl.hpp"
+#include "spirv_parser.hpp"
+
+std::string CrossCompileOptions::fingerprint() const {
+    std::string str = "msl=" + std::to_string(msl.versionMajor) + "." + std::to_string(msl.versionMinor);
+    str += ",framebuffer_fetch=" + std::to_string(msl.framebufferFetchSubpasses);
+    if (glsl.enabled) {
+        str += ";glsl=" + std::to_string(glsl.version) + (glsl.es ? "es" : "");
+        str += ",push_constant_ubo=" + std::to_string(glsl.emitPushConstantAsUniformBuffer);
+        str += ",420pack=" + std::to_string(glsl.enable420PackExtension);
+    }
+    if (hlsl.enabled)
+        str += ";hlsl=" + std::to_string(hlsl.shaderModel);
+
+    return str;
+}
+
+CrossCompileOutput crossCompileSpirv(std::span<const uint32_t> spirvBinary, const CrossCompileOptions& crossOptions, BuildTrace& trace, std::string_view shaderName) {
+    CrossCompileOutput output;
+
+    //Parse once, every backend gets its own copy of the IR, MSL takes the original
+    auto parseStart = BuildTrace::Clock::now();
+    uint64_t parseStartAllocations = threadAllocationCount();
+    uint64_t parseStartPeakResident = (trace.enabled ? peakResidentBytes() : 0);
+    spirv_cross::Parser parser(spirvBinary.data(), spirvBinary.size());
+    parser.parse();
+    spirv_cross::ParsedIR& ir = parser.get_parsed_ir();
+    auto parseEnd = BuildTrace::Clock::now();
+    output.parseMs = std::chrono::duration<double, std::milli>(parseEnd - parseStart).count();
+    if (trace.enabled)
+        trace.record("spirv.parse", shaderName, parseStart, parseEnd, threadAllocationCount() - parseStartAllocations, peakResidentBytes() - parseStartPeakResident);
+
+    //GLSL
+    if (crossOptions.glsl.enabled) {
+        TraceScope compileScope(trace, "glsl.compile", shaderName);
+        auto copyStart = BuildTrace::Clock::now();
+        spirv_cross::CompilerGLSL glsl(ir);
+        output.irCopyMs += std::chrono::duration<double, std::milli>(BuildTrace::Clock::now() - copyStart).count();
+
+        spirv_cross::CompilerGLSL::Options options;
+        options.version = crossOptions.glsl.version;
+        options.es = crossOptions.glsl.es;
+        options.emit_push_constant_as_uniform_buffer = crossOptions.glsl.emitPushConstantAsUniformBuffer;
+        options.enable_420pack_extension = crossOptions.glsl.enable420PackExtension;
+        //Does not work on Apple devices for some reason
+        //options.separate_shader_objects = true;
+        glsl.set_common_options(options);
+
+        output.glsl = glsl.compile();
+    }
+
+    //HLSL
+    if (crossOptions.hlsl.enabled) {
+        TraceScope compileScope(trace, "hlsl.compile", shaderName);
+        auto copyStart = BuildTrace::Clock::now();
+        spirv_cross::CompilerHLSL hlsl(ir);
+        output.irCopyMs += std::chrono::duration<double, std::milli>(BuildTrace::Clock::now() - copyStart).count();
+
+        spirv_cross::CompilerHLSL::Options options;
+        options.shader_model = crossOptions.hlsl.shaderModel;
+        hlsl.set_hlsl_options(options);
+
+        output.hlsl = hlsl.compile();
+    }
+
+    //MSL
+	spirv_cross::CompilerMSL msl(std::move(ir));
+
+	// Set some options.
+	spirv_cross::CompilerMSL::Options options = msl.get_msl_options();
+    //options.platform = spirv_cross::CompilerMSL::Options::Platform::macOS;
+    options.msl_version = spirv_cross::CompilerMSL::Options::make_msl_version(crossOptions.msl.versionMajor, crossOptions.msl.versionMinor);
+    options.use_framebuffer_fetch_subpasses = crossOptions.msl.framebufferFetchSubpasses;
+	msl.set_msl_options(options);
+    if (!crossOptions.msl.entryPointName.empty()) {
+        for (auto& entryPoint : msl.get_entry_points_and_stages())
+            msl.rename_entry_point(entryPoint.name, crossOptions.msl.entryPointName, entryPoint.execution_model);
+    }
+
+    {
+        TraceScope compileScope(trace, "msl.compile", shaderName);
+        output.msl = msl.compile();
+    }
+    //std::cout << "METAL SOURCE:\n\n" << output.msl << "\n\n\n\n" << std::endl;
+
+    //Bindings
+    TraceScope reflectionScope(trace, "reflection", shaderName);
+    std::optional<PushConstant>& pushConstant = output.reflection.pushConstant;
+    std::vector<BufferBinding>& bufferBindings = output.reflection.bufferBindings;
+    std::vector<SampledImageBinding>& sampledImageBindings = output.reflection.sampledImageBindings;
+    std::vector<ImageBinding>& imageBindings = output.reflection.imageBindings;
+
+	spirv_cross::ShaderResources resources = msl.get_shader_resources();
+
+	for (auto& resource : resources.push_constant_buffers) {
+        //auto& glslResource = glsl.get_shader_resources().push_constant_buffers[0];
+        //std::cout << glsl.get_name(glslResource.id) << std::endl;
+        pushConstant = PushConstant{
+            //glslResource.name,
+            msl.get_automatic_msl_resource_binding(resource.id)
+        };
+    }
+
+    for (auto& resource : resources.uniform_buffers) {
+        BufferBinding uniformBufferBinding{
+            //resource.name,
+            msl.get_decoration(resource.id, spv::DecorationDescriptorSet),
+            msl.get_decoration(resource.id, spv::DecorationBinding),
+            msl.get_automatic_msl_resource_binding(resource.id)
+        };
+
+        /*
+        spirv_cross::MSLResourceBinding resBinding;
+        resBinding.stage = spv::ExecutionModelFragment;
+        resBinding.desc_set = set;
+        resBinding.binding = binding;
+        resBinding.msl_buffer = uniformBufferBinding.outBufferBinding;
+
+        msl.add_msl_resource_binding(resBinding);
+        */
+
+        bufferBindings.push_back(uniformBufferBinding);
+    }
+
+    for (auto& resource : resources.storage_buffers) {
+        BufferBinding storageSpaceBufferBinding{
+            msl.get_decoration(resource.id, spv::DecorationDescriptorSet),
+            msl.get_decoration(resource.id, spv::DecorationBinding),
+            msl.get_automatic_msl_resource_binding(resource.id)
+        };
+
+        bufferBindings.push_back(storageSpaceBufferBinding);
+    }
+
+	for (auto& resource : resources.sampled_images) {
+        SampledImageBinding sampledImageBinding{
+            //resource.name,
+            msl.get_decoration(resource.id, spv::DecorationDescriptorSet),
+            msl.get_decoration(resource.id, spv::DecorationBinding),
+            msl.get_automatic_msl_resource_binding(resource.id),
+            msl.get_automatic_msl_resource_binding_secondary(resource.id)
+        };
+        
+        /*
+        spirv_cross::MSLResourceBinding resBinding;
+        resBinding.stage = spv::ExecutionModelFragment;
+        resBinding.desc_set = set;
+        resBinding.binding = binding;
+        resBinding.msl_texture = sampledImageBinding.outTextureBinding;
+        resBinding.msl_sampler = sampledImageBinding.outSamplerBinding;
+
+        msl.add_msl_resource_binding(resBinding);
+        */
+
+        sampledImageBindings.push_back(sampledImageBinding);
+	}
+
+	for (auto& resource : resources.storage_images) {
+        ImageBinding imageBinding{
+            msl.get_decoration(resource.id, spv::DecorationDescriptorSet),
+            msl.get_decoration(resource.id, spv::DecorationBinding),
+            msl.get_automatic_msl_resource_binding(resource.id)
+        };
+
+        imageBindings.push_back(imageBinding);
+	}
+
+    for (auto& resource : resources.subpass_inputs) {
+        ImageBinding imageBinding{
+            //resource.name,
+            msl.get_decoration(resource.id, spv::DecorationDescriptorSet),
+            msl.get_decoration(resource.id, spv::DecorationBinding),
+            msl.get_automatic_msl_resource_binding(resource.id)
+        };
+
+        imageBindings.push_back(imageBinding);
+    }
+
+    if (msl.get_execution_model() == spv::ExecutionModelVertex) {
+        for (auto& resource : resources.stage_inputs) {
+            const spirv_cross::SPIRType& type = msl.get_type(resource.type_id);
+            VertexInputBaseType baseType = VertexInputBaseType::Float;
+            if (type.basetype == spirv_cross::SPIRType::Half)
+                baseType = VertexInputBaseType::Half;
+            else if (type.basetype == spirv_cross::SPIRType::Int)
+                baseType = VertexInputBaseType::Int;
+            else if (type.basetype == spirv_cross::SPIRType::UInt)
+                baseType = VertexInputBaseType::UInt;
+
+            output.reflection.vertexInputs.push_back({msl.get_decoration(resource.id, spv::DecorationLocation), baseType, type.vecsize});
+        }
+        std::sort(output.reflection.vertexInputs.begin(), output.reflection.vertexInputs.end(), [](const VertexInput& a, const VertexInput& b) {
+            return a.location < b.location;
+        });
+    }
+
+    return output;
+}
@@ -0,0 +1,114 @@
+#ifndef LV_CROSS_COMPILER_H
+#define LV_CROSS_COMPILER_H
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "trace.hpp"
+
+struct PushConstant {
+    //std::string name;
+    uint32_t outBufferBinding;
+};
+
+struct BufferBinding {
+    //std::string name;
+    uint32_t inSet;
+    uint32_t inBinding;
+    uint32_t outBufferBinding;
+};
+
+struct SampledImageBinding {
+    //std::string name;
+    uint32_t inSet;
+    uint32_t inBinding;
+    uint32_t outTextureBinding;
+    uint32_t outSamplerBinding;
+};
+
+struct ImageBinding {
+    //std::string name;
+    uint32_t inSet;
+    uint32_t inBinding;
+    uint32_t outTextureBinding;
+};
+
+enum class VertexInputBaseType {
+    Float,
+    Half,
+    Int,
+    UInt
+};
+
+struct VertexInput {
+    uint32_t location;
+    VertexInputBaseType baseType;
+    uint32_t componentCount;
+};
+
+struct ShaderReflection {
+    std::optional<PushConstant> pushConstant;
+    std::vector<BufferBinding> bufferBindings;
+    std::vector<SampledImageBinding> sampledImageBindings;
+    std::vector<ImageBinding> imageBindings;
+    //Vertex shaders only
+    std::vector<VertexInput> vertexInputs;
+};
+
+//MSL is always emitted, the reflection is built from its resource indices
+struct MslTargetOptions {
+    uint32_t versionMajor = 3;
+    uint32_t versionMinor = 0;
+    bool framebufferFetchSubpasses = true;
+    //Renames the entry point, so that several shaders can share a library. Set per shader, so it is not part of the
+    //fingerprint, empty keeps spirv_cross' default.
+    std::string entryPointName;
+};
+
+//GL fallback
+struct GlslTargetOptions {
+    bool enabled = false;
+    uint32_t version = 410;
+    bool es = false;
+    bool emitPushConstantAsUniformBuffer = true;
+    bool enable420PackExtension = false;
+};
+
+struct HlslTargetOptions {
+    bool enabled = false;
+    uint32_t shaderModel = 50;
+};
+
+struct CrossCompileOptions {
+    MslTargetOptions msl;
+    GlslTargetOptions glsl;
+    HlslTargetOptions hlsl;
+
+    uint32_t targetCount() const {
+        return 1 + glsl.enabled + hlsl.enabled;
+    }
+
+    //Part of the build cache key
+    std::string fingerprint() const;
+};
+
+struct CrossCompileOutput {
+    std::string msl;
+    std::string glsl;
+    std::string hlsl;
+    ShaderReflection reflection;
+    //Time spent parsing the module, every additional target would have cost this much again
+    double parseMs = 0.0;
+    //Time spent constructing the GLSL and HLSL compilers from copies of the parsed IR, what sharing the parse costs
+    double irCopyMs = 0.0;
+};
+
+//Parses the SPIR-V module once and runs every enabled backend on copies of the parsed IR. The parse, the
+//compiles and the reflection are recorded in `trace` under `shaderName`.
+CrossCompileOutput crossCompileSpirv(std::span<const uint32_t> spirvBinary, const CrossCompileOptions& options, BuildTrace& trace, std::string_view shaderName);
+
+#endif
@@ -0,0 +1,326 @@
+#include "frontend.hpp"
+
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <tuple>
+
+namespace {
+
+//A handful of SPIR-V enums, see the SPIR-V specification
+enum SpvOp : uint32_t {
+    OpName = 5,
+    OpMemoryModel = 14,
+    OpEntryPoint = 15,
+    OpExecutionMode = 16,
+    OpCapability = 17,
+    OpTypeVoid = 19,
+    OpTypeFloat = 22,
+    OpTypeVector = 23,
+    OpTypeImage = 25,
+    OpTypeSampledImage = 27,
+    OpTypeStruct = 30,
+    OpTypePointer = 32,
+    OpTypeFunction = 33,
+    OpFunction = 54,
+    OpFunctionEnd = 56,
+    OpVariable = 59,
+    OpLoad = 61,
+    OpDecorate = 71,
+    OpMemberDecorate = 72,
+    OpLabel = 248,
+    OpReturn = 253
+};
+
+const uint32_t SPV_MAGIC = 0x07230203;
+const uint32_t SPV_VERSION_1_0 = 0x00010000;
+
+const uint32_t CAPABILITY_SHADER = 1;
+const uint32_t CAPABILITY_INPUT_ATTACHMENT = 40;
+
+const uint32_t STORAGE_CLASS_UNIFORM_CONSTANT = 0;
+const uint32_t STORAGE_CLASS_UNIFORM = 2;
+const uint32_t STORAGE_CLASS_PUSH_CONSTANT = 9;
+
+const uint32_t DECORATION_BLOCK = 2;
+const uint32_t DECORATION_BUFFER_BLOCK = 3;
+const uint32_t DECORATION_BINDING = 33;
+const uint32_t DECORATION_DESCRIPTOR_SET = 34;
+const uint32_t DECORATION_OFFSET = 35;
+const uint32_t DECORATION_INPUT_ATTACHMENT_INDEX = 43;
+
+const uint32_t DIM_2D = 1;
+const uint32_t DIM_SUBPASS_DATA = 6;
+const uint32_t IMAGE_FORMAT_UNKNOWN = 0;
+const uint32_t IMAGE_FORMAT_RGBA8 = 4;
+
+enum class FakeResourceType {
+    UniformBuffer,
+    StorageBuffer,
+    PushConstant,
+    SampledImage,
+    StorageImage,
+    SubpassInput
+};
+
+struct FakeResource {
+    FakeResourceType type;
+    std::string name;
+    uint32_t set = 0;
+    uint32_t binding = 0;
+    uint32_t inputAttachmentIndex = 0;
+};
+
+class SpirvModuleBuilder {
+public:
+    std::vector<uint32_t> capabilities;
+    std::vector<uint32_t> header;
+    std::vector<uint32_t> debug;
+    std::vector<uint32_t> annotations;
+    std::vector<uint32_t> globals;
+    std::vector<uint32_t> functions;
+
+    uint32_t allocateId() {
+        return nextId++;
+    }
+
+    void emit(std::vector<uint32_t>& section, uint32_t opcode, std::initializer_list<uint32_t> operands, std::string_view str = {}) {
+        //Strings are nul terminated and padded to a whole word
+        uint32_t stringWords = (str.data() ? (uint32_t)(str.size() / 4 + 1) : 0);
+        uint32_t wordCount = 1 + (uint32_t)operands.size() + stringWords;
+        section.push_back((wordCount << 16) | opcode);
+        section.insert(section.end(), operands.begin(), operands.end());
+        if (str.data()) {
+            size_t first = section.size();
+            section.resize(first + stringWords, 0);
+            memcpy(&section[first], str.data(), str.size());
+        }
+    }
+
+    //Non-aggregate types have to be unique
+    uint32_t getType(uint32_t opcode, std::vector<uint32_t> operands) {
+        auto key = std::make_tuple(opcode, operands);
+        auto it = typeCache.find(key);
+        if (it != typeCache.end())
+            return it->second;
+
+        uint32_t id = allocateId();
+        globals.push_back(((2 + (uint32_t)operands.size()) << 16) | opcode);
+        globals.push_back(id);
+        globals.insert(globals.end(), operands.begin(), operands.end());
+        typeCache[key] = id;
+
+        return id;
+    }
+
+    std::vector<uint32_t> finish() {
+        std::vector<uint32_t> words = {SPV_MAGIC, SPV_VERSION_1_0, 0, nextId, 0};
+        for (auto* section : {&capabilities, &header, &debug, &annotations, &globals, &functions})
+            words.insert(words.end(), section->begin(), section->end());
+
+        return words;
+    }
+
+private:
+    uint32_t nextId = 1;
+    std::map<std::tuple<uint32_t, std::vector<uint32_t>>, uint32_t> typeCache;
+};
+
+std::string_view trim(std::string_view str) {
+    size_t start = str.find_first_not_of(" \t\r\n");
+    if (start == std::string_view::npos)
+        return {};
+    size_t end = str.find_last_not_of(" \t\r\n");
+
+    return str.substr(start, end - start + 1);
+}
+
+uint32_t parseUint(std::string_view str) {
+    uint32_t value = 0;
+    for (char c : str) {
+        if (c < '0' || c > '9')
+            break;
+        value = value * 10 + (c - '0');
+    }
+
+    return value;
+}
+
+//Only understands "layout(...) <qualifiers> <type or block name> ..." declarations, which is all the fake needs
+std::vector<FakeResource> parseResources(std::string_view source) {
+    std::vector<FakeResource> resources;
+    size_t pos = 0;
+    while ((pos = source.find("layout", pos)) != std::string_view::npos) {
+        bool wordStart = (pos == 0 || !(isalnum((unsigned char)source[pos - 1]) || source[pos - 1] == '_'));
+        pos += 6;
+        size_t open = source.find_first_not_of(" \t\r\n", pos);
+        if (!wordStart || open == std::string_view::npos || source[open] != '(')
+            continue;
+        size_t close = source.find(')', open);
+        if (close == std::string_view::npos)
+            break;
+        pos = close + 1;
+
+        FakeResource resource;
+        bool pushConstant = false;
+        std::string_view args = source.substr(open + 1, close - open - 1);
+        while (!args.empty()) {
+            size_t comma = args.find(',');
+            std::string_view arg = args.substr(0, comma);
+            args = (comma == std::string_view::npos ? std::string_view() : args.substr(comma + 1));
+
+            size_t equals = arg.find('=');
+            std::string_view key = trim(arg.substr(0, equals));
+            std::string_view value = (equals == std::string_view::npos ? std::string_view() : trim(arg.substr(equals + 1)));
+            if (key == "set")
+                resource.set = parseUint(value);
+            else if (key == "binding")
+                resource.binding = parseUint(value);
+            else if (key == "input_attachment_index")
+                resource.inputAttachmentIndex = parseUint(value);
+            else if (key == "push_constant")
+                pushConstant = true;
+        }
+
+        size_t declarationEnd = source.find_first_of(";{", pos);
+        if (declarationEnd == std::string_view::npos)
+            break;
+        std::string_view declaration = source.substr(pos, declarationEnd - pos);
+        bool isBlock = (source[declarationEnd] == '{');
+
+        std::vector<std::string_view> tokens;
+        while (!(declaration = trim(declaration)).empty()) {
+            size_t end = declaration.find_first_of(" \t\r\n");
+            tokens.push_back(declaration.substr(0, end));
+            declaration = (end == std::string_view::npos ? std::string_view() : declaration.substr(end));
+        }
+        if (tokens.size() < 2)
+            continue;
+
+        std::string_view qualifier = tokens[tokens.size() - 2];
+        std::string_view typeName = tokens.back();
+        if (isBlock && qualifier == "uniform") {
+            resource.type = (pushConstant ? FakeResourceType::PushConstant : FakeResourceType::UniformBuffer);
+        } else if (isBlock && qualifier == "buffer") {
+            resource.type = FakeResourceType::StorageBuffer;
+        } else if (!isBlock && tokens.size() >= 3 && tokens[tokens.size() - 3] == "uniform") {
+            typeName = tokens[tokens.size() - 2];
+            if (typeName.substr(0, 7) == "sampler")
+                resource.type = FakeResourceType::SampledImage;
+            else if (typeName.substr(0, 12) == "subpassInput")
+                resource.type = FakeResourceType::SubpassInput;
+            else if (typeName.substr(0, 5) == "image")
+                resource.type = FakeResourceType::StorageImage;
+            else
+                continue;
+            typeName = tokens.back();
+        } else {
+            continue;
+        }
+        resource.name = std::string(typeName);
+
+        resources.push_back(resource);
+    }
+
+    return resources;
+}
+
+} //namespace
+
+//Never fails, every source gives a module
+bool FakeGlslFrontend::compile(const FrontendInput& input, std::vector<uint32_t>& spirv, std::string&) {
+    std::vector<FakeResource> resources = parseResources(input.source);
+
+    SpirvModuleBuilder builder;
+    builder.emit(builder.capabilities, OpCapability, {CAPABILITY_SHADER});
+    for (auto& resource : resources) {
+        if (resource.type == FakeResourceType::SubpassInput) {
+            builder.emit(builder.capabilities, OpCapability, {CAPABILITY_INPUT_ATTACHMENT});
+            break;
+        }
+    }
+
+    uint32_t executionModel = 0;
+    switch (input.stage) {
+    case ShaderStage::Vertex:
+        executionModel = 0;
+        break;
+    case ShaderStage::Fragment:
+        executionModel = 4;
+        break;
+    case ShaderStage::Compute:
+        executionModel = 5;
+        break;
+    }
+
+    uint32_t mainId = builder.allocateId();
+    builder.emit(builder.header, OpMemoryModel, {0, 1});
+    builder.emit(builder.header, OpEntryPoint, {executionModel, mainId}, "main");
+    if (input.stage == ShaderStage::Fragment)
+        builder.emit(builder.header, OpExecutionMode, {mainId, 7});
+    else if (input.stage == ShaderStage::Compute)
+        builder.emit(builder.header, OpExecutionMode, {mainId, 17, 1, 1, 1});
+    builder.emit(builder.debug, OpName, {mainId}, "main");
+
+    uint32_t voidType = builder.getType(OpTypeVoid, {});
+    uint32_t functionType = builder.getType(OpTypeFunction, {voidType});
+    uint32_t floatType = builder.getType(OpTypeFloat, {32});
+    uint32_t vec4Type = builder.getType(OpTypeVector, {floatType, 4});
+
+    struct Load {
+        uint32_t type;
+        uint32_t variable;
+    };
+    std::vector<Load> loads;
+    for (auto& resource : resources) {
+        uint32_t type = 0;
+        uint32_t storageClass = STORAGE_CLASS_UNIFORM_CONSTANT;
+        switch (resource.type) {
+        case FakeResourceType::UniformBuffer:
+        case FakeResourceType::StorageBuffer:
+        case FakeResourceType::PushConstant:
+            //Block types are aggregates, so every block gets its own
+            type = builder.allocateId();
+            builder.emit(builder.globals, OpTypeStruct, {type, vec4Type});
+            builder.emit(builder.debug, OpName, {type}, resource.name);
+            builder.emit(builder.annotations, OpDecorate, {type, resource.type == FakeResourceType::StorageBuffer ? DECORATION_BUFFER_BLOCK : DECORATION_BLOCK});
+            builder.emit(builder.annotations, OpMemberDecorate, {type, 0, DECORATION_OFFSET, 0});
+            storageClass = (resource.type == FakeResourceType::PushConstant ? STORAGE_CLASS_PUSH_CONSTANT : STORAGE_CLASS_UNIFORM);
+            break;
+        case FakeResourceType::SampledImage:
+            type = builder.getType(OpTypeSampledImage, {builder.getType(OpTypeImage, {floatType, DIM_2D, 0, 0, 0, 1, IMAGE_FORMAT_UNKNOWN})});
+            break;
+        case FakeResourceType::StorageImage:
+            type = builder.getType(OpTypeImage, {floatType, DIM_2D, 0, 0, 0, 2, IMAGE_FORMAT_RGBA8});
+            break;
+        case FakeResourceType::SubpassInput:
+            type = builder.getType(OpTypeImage, {floatType, DIM_SUBPASS_DATA, 0, 0, 0, 2, IMAGE_FORMAT_UNKNOWN});
+            break;
+        }
+
+        uint32_t pointerType = builder.getType(OpTypePointer, {storageClass, type});
+        uint32_t variable = builder.allocateId();
+        builder.emit(builder.globals, OpVariable, {pointerType, variable, storageClass});
+        builder.emit(builder.debug, OpName, {variable}, resource.name);
+        if (resource.type != FakeResourceType::PushConstant) {
+            builder.emit(builder.annotations, OpDecorate, {variable, DECORATION_DESCRIPTOR_SET, resource.set});
+            builder.emit(builder.annotations, OpDecorate, {variable, DECORATION_BINDING, resource.binding});
+        }
+        if (resource.type == FakeResourceType::SubpassInput)
+            builder.emit(builder.annotations, OpDecorate, {variable, DECORATION_INPUT_ATTACHMENT_INDEX, resource.inputAttachmentIndex});
+
+        loads.push_back({type, variable});
+    }
+
+    //Load every resource once, so that it counts as used by the entry point
+    builder.emit(builder.functions, OpFunction, {voidType, mainId, 0, functionType});
+    builder.emit(builder.functions, OpLabel, {builder.allocateId()});
+    for (auto& load : loads)
+        builder.emit(builder.functions, OpLoad, {load.type, builder.allocateId(), load.variable});
+    builder.emit(builder.functions, OpReturn, {});
+    builder.emit(builder.functions, OpFunctionEnd, {});
+
+    spirv = builder.finish();
+
+    return true;
+}
@@ -0,0 +1,55 @@
+#include "file_utils.hpp"
+
+#include <cstdio>
+#include <iostream>
+
+std::vector<uint32_t> readFile(const char* path) {
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		std::cerr << "Failed to open file: " << path << std::endl;
+
+		return {};
+	}
+
+	fseek(file, 0, SEEK_END);
+	long len = ftell(file) / sizeof(uint32_t);
+	rewind(file);
+
+	std::vector<uint32_t> fileData(len);
+	if (fread(fileData.data(), sizeof(uint32_t), len, file) != size_t(len))
+		fileData.clear();
+
+	fclose(file);
+
+	return fileData;
+}
+
+bool readFileBytes(const char* path, std::string& content) {
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long len = ftell(file);
+	rewind(file);
+
+	content.resize(len);
+	bool succeeded = (fread(content.data(), 1, len, file) == size_t(len));
+	fclose(file);
+
+	return succeeded;
+}
+
+bool writeFileBytes(const char* path, const void* data, size_t size) {
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		std::cerr << "Failed to write file: " << path << std::endl;
+
+		return false;
+	}
+
+	bool succeeded = (fwrite(data, 1, size, file) == size);
+	fclose(file);
+
+	return succeeded;
+}
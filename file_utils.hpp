@@ -0,0 +1,15 @@
+#ifndef LV_FILE_UTILS_H
+#define LV_FILE_UTILS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+std::vector<uint32_t> readFile(const char* path);
+
+//Binary safe, the whole file is read with a single read call
+bool readFileBytes(const char* path, std::string& content);
+
+bool writeFileBytes(const char* path, const void* data, size_t size);
+
+#endif
@@ -0,0 +1,177 @@
+#include "file_watcher.hpp"
+
+#include <algorithm>
+#include <filesystem>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+#ifdef __linux__
+const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR;
+
+FileWatcher::~FileWatcher() {
+    if (fd >= 0)
+        close(fd);
+}
+
+bool FileWatcher::open() {
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    return fd >= 0;
+}
+
+bool FileWatcher::isIgnored(const std::string& path) const {
+    fs::path dirPath(path);
+    if (dirPath.filename().string().rfind('.', 0) == 0)
+        return true;
+
+    std::string relPath = dirPath.lexically_normal().lexically_relative(fs::path(rootDir).lexically_normal()).generic_string();
+
+    return std::find(ignoredPaths.begin(), ignoredPaths.end(), relPath) != ignoredPaths.end();
+}
+
+bool FileWatcher::addDirectory(const std::string& path, const std::vector<std::string>& paths) {
+    rootDir = path;
+    ignoredPaths = paths;
+
+    return watchDirectory(path);
+}
+
+bool FileWatcher::watchDirectory(const std::string& path) {
+    int wd = inotify_add_watch(fd, path.c_str(), WATCH_MASK);
+    if (wd < 0)
+        return false;
+    watchedDirs[wd] = path;
+
+    std::error_code error;
+    for (auto& dirEntry : fs::directory_iterator(path, error)) {
+        if (dirEntry.is_directory(error) && !isIgnored(dirEntry.path().string()))
+            watchDirectory(dirEntry.path().string());
+    }
+
+    return true;
+}
+
+void FileWatcher::unwatchDirectory(const std::string& path) {
+    for (auto it = watchedDirs.begin(); it != watchedDirs.end();) {
+        if (it->second == path || it->second.rfind(path + "/", 0) == 0) {
+            inotify_rm_watch(fd, it->first);
+            it = watchedDirs.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+bool FileWatcher::readEvents(int timeoutMs, std::vector<std::string>& changedPaths, bool& overflowed) {
+    pollfd pollFd{fd, POLLIN, 0};
+    if (poll(&pollFd, 1, timeoutMs) <= 0)
+        return false;
+
+    alignas(inotify_event) char buffer[16 * 1024];
+    bool received = false;
+    ssize_t length;
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (char* ptr = buffer; ptr < buffer + length; ptr += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(ptr)->len) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(ptr);
+            //The kernel queue was full and events were dropped, not tied to any watch
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflowed = true;
+                received = true;
+                continue;
+            }
+            auto dir = watchedDirs.find(event->wd);
+            if (dir == watchedDirs.end())
+                continue;
+
+            if (event->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+                watchedDirs.erase(dir);
+                continue;
+            }
+            if (event->len == 0)
+                continue;
+
+            std::string path = dir->second + "/" + event->name;
+            if (event->mask & IN_ISDIR) {
+                if (isIgnored(path))
+                    continue;
+
+                //A new directory may already contain files by the time the watch is added
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    watchDirectory(path);
+                    std::error_code error;
+                    for (auto& dirEntry : fs::recursive_directory_iterator(path, error))
+                        changedPaths.push_back(dirEntry.path().string());
+                    received = true;
+                } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    //A directory moved out of the tree keeps its watches, which would report it under its old path
+                    unwatchDirectory(path);
+                    changedPaths.push_back(path);
+                    received = true;
+                }
+                continue;
+            }
+
+            changedPaths.push_back(path);
+            received = true;
+        }
+    }
+
+    return received;
+}
+
+bool FileWatcher::waitForChanges(std::chrono::milliseconds debounce, std::vector<std::string>& changedPaths, std::chrono::steady_clock::time_point& firstEvent, bool& overflowed) {
+    changedPaths.clear();
+    overflowed = false;
+    if (fd < 0)
+        return false;
+
+    while (!readEvents(-1, changedPaths, overflowed)) {
+        if (watchedDirs.empty())
+            return false;
+    }
+    firstEvent = std::chrono::steady_clock::now();
+
+    //Editors tend to write a file several times in a row (truncate, write, rename), wait for them to settle
+    while (readEvents((int)debounce.count(), changedPaths, overflowed));
+
+    std::sort(changedPaths.begin(), changedPaths.end());
+    changedPaths.erase(std::unique(changedPaths.begin(), changedPaths.end()), changedPaths.end());
+
+    return true;
+}
+#else
+FileWatcher::~FileWatcher() {}
+
+bool FileWatcher::isIgnored(const std::string& path) const {
+    return false;
+}
+
+bool FileWatcher::open() {
+    return false;
+}
+
+bool FileWatcher::addDirectory(const std::string& path, const std::vector<std::string>& paths) {
+    return false;
+}
+
+bool FileWatcher::watchDirectory(const std::string& path) {
+    return false;
+}
+
+void FileWatcher::unwatchDirectory(const std::string& path) {
+}
+
+bool FileWatcher::readEvents(int timeoutMs, std::vector<std::string>& changedPaths, bool& overflowed) {
+    return false;
+}
+
+bool FileWatcher::waitForChanges(std::chrono::milliseconds debounce, std::vector<std::string>& changedPaths, std::chrono::steady_clock::time_point& firstEvent, bool& overflowed) {
+    return false;
+}
+#endif
@@ -0,0 +1,51 @@
+#ifndef LV_FILE_WATCHER_H
+#define LV_FILE_WATCHER_H
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//Recursive directory watcher on top of inotify. Only available on Linux, open() fails everywhere else.
+class FileWatcher {
+public:
+    FileWatcher() = default;
+
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    bool open();
+
+    //Watches the directory and all of its subdirectories, subdirectories created later are picked up as well. Hidden
+    //subdirectories are skipped at any depth, the ignored paths only where they are: "compiled" skips <path>/compiled
+    //but not <path>/source/compiled_effects or <path>/source/compiled.
+    bool addDirectory(const std::string& path, const std::vector<std::string>& ignoredPaths = {});
+
+    //Blocks until a file is written, created, moved or deleted, then keeps collecting events until none arrived
+    //for `debounce`, so a burst of editor saves turns into a single rebuild. `firstEvent` is when the first event of
+    //the burst was received. The paths are deduplicated and sorted. A deleted or moved out directory is reported as
+    //its own path, which may be all there is about the files that were in it. `overflowed` is set if the kernel dropped
+    //events, the changes are incomplete then and the whole tree has to be rescanned.
+    bool waitForChanges(std::chrono::milliseconds debounce, std::vector<std::string>& changedPaths, std::chrono::steady_clock::time_point& firstEvent, bool& overflowed);
+
+private:
+    int fd = -1;
+    std::unordered_map<int, std::string> watchedDirs;
+    std::string rootDir;
+    //Relative to rootDir, with forward slashes
+    std::vector<std::string> ignoredPaths;
+
+    bool isIgnored(const std::string& path) const;
+
+    bool watchDirectory(const std::string& path);
+
+    //Drops the watches of the directory and everything below it
+    void unwatchDirectory(const std::string& path);
+
+    //Returns false if nothing arrived before the timeout, a negative timeout waits forever
+    bool readEvents(int timeoutMs, std::vector<std::string>& changedPaths, bool& overflowed);
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include "frontend.hpp"
+
+#include <filesystem>
+
+#include "build_cache.hpp"
+#include "file_utils.hpp"
+#include "process.hpp"
+
+const char* shaderStageName(ShaderStage stage) {
+    switch (stage) {
+    case ShaderStage::Vertex:
+        return "vert";
+    case ShaderStage::Fragment:
+        return "frag";
+    case ShaderStage::Compute:
+        return "comp";
+    }
+
+    return "unknown";
+}
+
+std::string ExternalGlslFrontend::fingerprint() const {
+    std::string fingerprint = "glslc:" + options.compilerPath;
+    FileStamp compilerStamp;
+    if (getFileStamp(options.compilerPath, compilerStamp))
+        fingerprint += ":" + std::to_string(compilerStamp.size) + ":" + std::to_string(compilerStamp.mtime);
+
+    return fingerprint;
+}
+
+bool ExternalGlslFrontend::compile(const FrontendInput& input, std::vector<uint32_t>& spirv, std::string& errors) {
+    std::string glslSourceFile = input.scratchDir + "/" + input.scratchName + "." + shaderStageName(input.stage);
+    std::string spirvCompiledFile = input.scratchDir + "/" + input.scratchName + ".spv";
+    if (!writeFileBytes(glslSourceFile.c_str(), input.source.data(), input.source.size())) {
+        errors += "Failed to write '" + glslSourceFile + "'\n";
+
+        return false;
+    }
+
+    //glslc only sees the copy in the scratch directory, so includes next to the original source are found through the
+    //first -I, the same way the glslang frontend resolves them
+    std::string sourceDir = std::filesystem::path(input.sourcePath).parent_path().string();
+    std::string command = "\"" + options.compilerPath + "\" -fshader-stage=" + shaderStageName(input.stage);
+    command += " -I \"" + (sourceDir.empty() ? std::string(".") : sourceDir) + "\"";
+    for (auto& includeDir : options.includeDirs)
+        command += " -I \"" + includeDir + "\"";
+    command += " \"" + glslSourceFile + "\" -o \"" + spirvCompiledFile + "\"";
+    if (!runCommand(command, errors))
+        return false;
+
+    spirv = readFile(spirvCompiledFile.c_str());
+    if (spirv.empty()) {
+        errors += "glslc produced no SPIR-V for '" + input.sourcePath + "'\n";
+
+        return false;
+    }
+
+    return true;
+}
+
+const char* defaultGlslFrontendName() {
+#ifdef LV_SHADER_COMPILER_GLSLANG
+    return "glslang";
+#else
+    return "glslc";
+#endif
+}
+
+std::unique_ptr<GlslFrontend> createGlslFrontend(const std::string& name, const FrontendOptions& options) {
+    if (name == "glslc")
+        return std::make_unique<ExternalGlslFrontend>(options);
+#ifdef LV_SHADER_COMPILER_GLSLANG
+    if (name == "glslang")
+        return std::make_unique<GlslangFrontend>(options);
+#endif
+    if (name == "fake")
+        return std::make_unique<FakeGlslFrontend>();
+
+    return nullptr;
+}
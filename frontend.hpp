@@ -0,0 +1,97 @@
+#ifndef LV_FRONTEND_H
+#define LV_FRONTEND_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class ShaderStage {
+    Vertex,
+    Fragment,
+    Compute
+};
+
+//Short name as used by glslc's -fshader-stage ("vert", "frag", "comp")
+const char* shaderStageName(ShaderStage stage);
+
+struct FrontendInput {
+    std::string_view source;
+    ShaderStage stage;
+    //Used for diagnostics and for resolving includes relative to the shader
+    std::string sourcePath;
+    //Only used by frontends that have to go through files
+    std::string scratchDir;
+    std::string scratchName;
+};
+
+struct FrontendOptions {
+    std::string compilerPath;
+    std::vector<std::string> includeDirs;
+};
+
+//Turns GLSL into SPIR-V. Implementations must be safe to call from several threads at once.
+class GlslFrontend {
+public:
+    virtual ~GlslFrontend() = default;
+
+    virtual const char* name() const = 0;
+
+    //Identifies the frontend and its version, it is part of the build cache key
+    virtual std::string fingerprint() const = 0;
+
+    virtual bool compile(const FrontendInput& input, std::vector<uint32_t>& spirv, std::string& errors) = 0;
+};
+
+//Runs glslc as an external process, going through temporary files
+class ExternalGlslFrontend : public GlslFrontend {
+public:
+    explicit ExternalGlslFrontend(const FrontendOptions& options) : options(options) {}
+
+    const char* name() const override { return "glslc"; }
+
+    std::string fingerprint() const override;
+
+    bool compile(const FrontendInput& input, std::vector<uint32_t>& spirv, std::string& errors) override;
+
+private:
+    FrontendOptions options;
+};
+
+#ifdef LV_SHADER_COMPILER_GLSLANG
+//Links glslang in and compiles straight from memory to memory
+class GlslangFrontend : public GlslFrontend {
+public:
+    explicit GlslangFrontend(const FrontendOptions& options);
+
+    ~GlslangFrontend() override;
+
+    const char* name() const override { return "glslang"; }
+
+    std::string fingerprint() const override;
+
+    bool compile(const FrontendInput& input, std::vector<uint32_t>& spirv, std::string& errors) override;
+
+private:
+    FrontendOptions options;
+};
+#endif
+
+//Does not compile anything, it emits a small but valid SPIR-V module with the entry point and the resources
+//declared in the source. Meant for testing the rest of the pipeline on machines without the Vulkan SDK.
+class FakeGlslFrontend : public GlslFrontend {
+public:
+    const char* name() const override { return "fake"; }
+
+    std::string fingerprint() const override { return "fake:1"; }
+
+    bool compile(const FrontendInput& input, std::vector<uint32_t>& spirv, std::string& errors) override;
+};
+
+const char* defaultGlslFrontendName();
+
+//Returns nullptr if there is no frontend with such name (or it wasn't compiled in)
+std::unique_ptr<GlslFrontend> createGlslFrontend(const std::string& name, const FrontendOptions& options);
+
+#endif
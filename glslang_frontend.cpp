@@ -0,0 +1,125 @@
+#ifdef LV_SHADER_COMPILER_GLSLANG
+
+#include "frontend.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include <glslang/build_info.h>
+#include <glslang/Public/ResourceLimits.h>
+#include <glslang/Public/ShaderLang.h>
+#include <glslang/SPIRV/GlslangToSpv.h>
+
+namespace {
+
+//Resolves includes the same way glslc does: relative to the including file first, then the include directories
+class FileIncluder : public glslang::TShader::Includer {
+public:
+    explicit FileIncluder(const std::vector<std::string>& includeDirs) : includeDirs(includeDirs) {}
+
+    IncludeResult* includeLocal(const char* headerName, const char* includerName, size_t inclusionDepth) override {
+        std::string includerDir = std::filesystem::path(includerName).parent_path().string();
+        if (IncludeResult* result = tryOpen(includerDir.empty() ? headerName : includerDir + "/" + headerName))
+            return result;
+
+        return includeSystem(headerName, includerName, inclusionDepth);
+    }
+
+    IncludeResult* includeSystem(const char* headerName, const char* includerName, size_t inclusionDepth) override {
+        for (auto& includeDir : includeDirs) {
+            if (IncludeResult* result = tryOpen(includeDir + "/" + headerName))
+                return result;
+        }
+
+        return nullptr;
+    }
+
+    void releaseInclude(IncludeResult* result) override {
+        if (result) {
+            delete static_cast<std::string*>(result->userData);
+            delete result;
+        }
+    }
+
+private:
+    const std::vector<std::string>& includeDirs;
+
+    IncludeResult* tryOpen(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return nullptr;
+
+        std::string* content = new std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+        return new IncludeResult(path, content->data(), content->size(), content);
+    }
+};
+
+EShLanguage getGlslangStage(ShaderStage stage) {
+    switch (stage) {
+    case ShaderStage::Vertex:
+        return EShLangVertex;
+    case ShaderStage::Fragment:
+        return EShLangFragment;
+    case ShaderStage::Compute:
+        return EShLangCompute;
+    }
+
+    return EShLangVertex;
+}
+
+} //namespace
+
+GlslangFrontend::GlslangFrontend(const FrontendOptions& options) : options(options) {
+    glslang::InitializeProcess();
+}
+
+GlslangFrontend::~GlslangFrontend() {
+    glslang::FinalizeProcess();
+}
+
+std::string GlslangFrontend::fingerprint() const {
+    return "glslang:" + std::to_string(GLSLANG_VERSION_MAJOR) + "." + std::to_string(GLSLANG_VERSION_MINOR) + "." + std::to_string(GLSLANG_VERSION_PATCH);
+}
+
+bool GlslangFrontend::compile(const FrontendInput& input, std::vector<uint32_t>& spirv, std::string& errors) {
+    EShLanguage language = getGlslangStage(input.stage);
+
+    //Same environment glslc defaults to: Vulkan 1.0, SPIR-V 1.0
+    glslang::TShader shader(language);
+    const char* strings[] = {input.source.data()};
+    const int lengths[] = {(int)input.source.size()};
+    const char* names[] = {input.sourcePath.c_str()};
+    shader.setStringsWithLengthsAndNames(strings, lengths, names, 1);
+    shader.setPreamble("#extension GL_GOOGLE_include_directive : enable\n");
+    shader.setEnvInput(glslang::EShSourceGlsl, language, glslang::EShClientVulkan, 100);
+    shader.setEnvClient(glslang::EShClientVulkan, glslang::EShTargetVulkan_1_0);
+    shader.setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_0);
+
+    EShMessages messages = (EShMessages)(EShMsgSpvRules | EShMsgVulkanRules);
+    FileIncluder includer(options.includeDirs);
+    if (!shader.parse(GetDefaultResources(), 100, false, messages, includer)) {
+        errors += shader.getInfoLog();
+
+        return false;
+    }
+
+    glslang::TProgram program;
+    program.addShader(&shader);
+    if (!program.link(messages)) {
+        errors += program.getInfoLog();
+
+        return false;
+    }
+
+    spv::SpvBuildLogger logger;
+    glslang::SpvOptions spvOptions;
+    spirv.clear();
+    glslang::GlslangToSpv(*program.getIntermediate(language), spirv, &logger, &spvOptions);
+    errors += logger.getAllMessages();
+
+    return !spirv.empty();
+}
+
+#endif
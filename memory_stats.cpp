@@ -0,0 +1,87 @@
+#include "memory_stats.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+//Per thread, so counting never contends. Constant initialized, it's safe to use before main() and in any thread.
+static thread_local uint64_t allocationCount = 0;
+
+//The array, nothrow and sized variants of the standard library all end up here or in the aligned version below
+void* operator new(std::size_t size) {
+    allocationCount++;
+    if (void* memory = std::malloc(size > 0 ? size : 1))
+        return memory;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+//Over-aligned types, e.g. alignas(64) members, go through these instead
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    allocationCount++;
+    //aligned_alloc wants a multiple of the alignment
+    size_t align = (size_t)alignment;
+    if (void* memory = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align))
+        return memory;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+uint64_t threadAllocationCount() {
+    return allocationCount;
+}
+
+uint64_t peakResidentBytes() {
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss;
+#else
+    //Kilobytes on Linux
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+void MemoryBudget::acquire(uint64_t bytes) {
+    if (limit == 0)
+        return;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [&]() { return inUse == 0 || inUse + bytes <= limit; });
+    inUse += bytes;
+}
+
+void MemoryBudget::release(uint64_t bytes) {
+    if (limit == 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        inUse -= bytes;
+    }
+    condition.notify_all();
+}
@@ -0,0 +1,32 @@
+#ifndef LV_MEMORY_STATS_H
+#define LV_MEMORY_STATS_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+//operator new calls made by the calling thread so far. Counting replaces the global operator new, so it only covers the
+//executables memory_stats.cpp is linked into.
+uint64_t threadAllocationCount();
+
+//High-water mark of the resident set of the whole process, 0 where the platform doesn't report it
+uint64_t peakResidentBytes();
+
+//Caps the estimated memory of the jobs in flight. A job that doesn't fit waits until enough of the others are done. A
+//job larger than the whole budget still runs once nothing else does, so a build never deadlocks on it.
+class MemoryBudget {
+public:
+    //In bytes, 0 means unlimited
+    uint64_t limit = 0;
+
+    void acquire(uint64_t bytes);
+
+    void release(uint64_t bytes);
+
+private:
+    std::mutex mutex;
+    std::condition_variable condition;
+    uint64_t inUse = 0;
+};
+
+#endif
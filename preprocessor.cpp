@@ -0,0 +1,280 @@
+#include "preprocessor.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+bool isIdentifierStart(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+bool isIdentifierChar(char c) {
+    return isIdentifierStart(c) || (c >= '0' && c <= '9');
+}
+
+bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+size_t skipSpaces(std::string_view source, size_t pos) {
+    while (pos < source.size() && (source[pos] == ' ' || source[pos] == '\t' || source[pos] == '\r' || source[pos] == '\n'))
+        pos++;
+
+    return pos;
+}
+
+//Matches "<spaces>=<spaces><digits>" and returns the range of the digits
+bool parseAssignedIndex(std::string_view source, size_t pos, size_t& indexStart, size_t& indexEnd) {
+    pos = skipSpaces(source, pos);
+    if (pos >= source.size() || source[pos] != '=')
+        return false;
+    indexStart = skipSpaces(source, pos + 1);
+    indexEnd = indexStart;
+    while (indexEnd < source.size() && isDigit(source[indexEnd]))
+        indexEnd++;
+
+    return indexEnd != indexStart;
+}
+
+bool matchesKeyword(std::string_view source, size_t pos, std::string_view keyword) {
+    return source.substr(pos, keyword.size()) == keyword &&
+        (pos + keyword.size() >= source.size() || !isIdentifierChar(source[pos + keyword.size()]));
+}
+
+void appendMacroDefinition(std::string& output, std::string_view macroName, std::string_view defines) {
+    output += "#define ";
+    output += macroName;
+    output += '\n';
+    output += defines;
+}
+
+//Splits off the next token separated by spaces or tabs
+std::string_view nextPragmaToken(std::string_view& line) {
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start == std::string_view::npos) {
+        line = {};
+        return {};
+    }
+    size_t end = line.find_first_of(" \t\r", start);
+    std::string_view token = line.substr(start, end - start);
+    line = (end == std::string_view::npos ? std::string_view() : line.substr(end));
+
+    return token;
+}
+
+bool isIdentifier(std::string_view token) {
+    return !token.empty() && isIdentifierStart(token[0]) && std::all_of(token.begin(), token.end(), isIdentifierChar);
+}
+
+} //namespace
+
+void parsePermutationAxes(std::string_view source, std::vector<PermutationAxis>& axes) {
+    axes.clear();
+
+    uint32_t line = 0;
+    size_t pos = 0;
+    while (pos < source.size()) {
+        line++;
+        size_t lineEnd = source.find('\n', pos);
+        std::string_view text = source.substr(pos, lineEnd == std::string_view::npos ? std::string_view::npos : lineEnd - pos);
+        pos = (lineEnd == std::string_view::npos ? source.size() : lineEnd + 1);
+
+        //"#pragma" and "# pragma" are both valid
+        size_t hash = text.find_first_not_of(" \t");
+        if (hash == std::string_view::npos || text[hash] != '#')
+            continue;
+        text = text.substr(hash + 1);
+        if (nextPragmaToken(text) != "pragma" || nextPragmaToken(text) != PERMUTATION_PRAGMA)
+            continue;
+
+        PermutationAxis axis;
+        axis.name = nextPragmaToken(text);
+        if (!isIdentifier(axis.name))
+            throw std::runtime_error("line " + std::to_string(line) + ": " + std::string(PERMUTATION_PRAGMA) + " expects a macro name");
+        for (std::string_view value = nextPragmaToken(text); !value.empty(); value = nextPragmaToken(text)) {
+            if (value.find_first_of(";=") != std::string_view::npos)
+                throw std::runtime_error("line " + std::to_string(line) + ": invalid value '" + std::string(value) + "' for '" + axis.name + "'");
+            axis.values.emplace_back(value);
+        }
+
+        for (auto& other : axes) {
+            if (other.name == axis.name)
+                throw std::runtime_error("line " + std::to_string(line) + ": '" + axis.name + "' is declared twice");
+        }
+        axes.push_back(std::move(axis));
+    }
+
+    std::sort(axes.begin(), axes.end(), [](const PermutationAxis& a, const PermutationAxis& b) {
+        return a.name < b.name;
+    });
+}
+
+std::vector<ShaderVariant> expandPermutations(const std::vector<PermutationAxis>& axes) {
+    size_t variantCount = 1;
+    for (auto& axis : axes) {
+        variantCount *= std::max<size_t>(axis.values.size(), 2);
+        if (variantCount > MAX_SHADER_VARIANTS)
+            throw std::runtime_error("more than " + std::to_string(MAX_SHADER_VARIANTS) + " permutations");
+    }
+
+    //Mixed radix counter over the axes, the last axis changes fastest
+    std::vector<ShaderVariant> variants(variantCount);
+    for (size_t i = 0; i < variantCount; i++) {
+        ShaderVariant& variant = variants[i];
+        size_t remaining = i;
+        for (size_t axisIndex = axes.size(); axisIndex-- > 0;) {
+            const PermutationAxis& axis = axes[axisIndex];
+            size_t choiceCount = std::max<size_t>(axis.values.size(), 2);
+            size_t choice = remaining % choiceCount;
+            remaining /= choiceCount;
+
+            if (axis.values.empty()) {
+                if (choice == 0)
+                    continue;
+                variant.defines = "#define " + axis.name + " 1\n" + variant.defines;
+                variant.name = axis.name + (variant.name.empty() ? "" : ";") + variant.name;
+            } else {
+                variant.defines = "#define " + axis.name + " " + axis.values[choice] + "\n" + variant.defines;
+                variant.name = axis.name + "=" + axis.values[choice] + (variant.name.empty() ? "" : ";") + variant.name;
+            }
+        }
+    }
+
+    return variants;
+}
+
+void preprocessGlslShader(std::string_view source, PreprocessedSource& output, std::string_view defines) {
+    std::string& vulkan = output.vulkanSource;
+    std::string& metal = output.metalSource;
+    vulkan.clear();
+    metal.clear();
+    //Each variant only grows by its macro definitions
+    vulkan.reserve(source.size() + VULKAN_BACKEND_MACRO.size() + defines.size() + 16);
+    metal.reserve(source.size() + METAL_BACKEND_MACRO.size() + defines.size() + 16);
+
+    //Everything in [copyStart, pos) is unchanged and still has to be copied into both variants
+    size_t copyStart = 0;
+    auto flush = [&](size_t end) {
+        vulkan.append(source.data() + copyStart, end - copyStart);
+        metal.append(source.data() + copyStart, end - copyStart);
+        copyStart = end;
+    };
+
+    auto error = [](uint32_t line, const char* message) {
+        return std::runtime_error("line " + std::to_string(line) + ": " + message);
+    };
+
+    bool versionFound = false;
+    bool macrosDefined = false;
+    uint32_t line = 1;
+    size_t pos = 0;
+    const size_t size = source.size();
+    while (pos < size) {
+        char c = source[pos];
+
+        if (c == '\n') {
+            line++;
+            pos++;
+            if (versionFound && !macrosDefined) {
+                flush(pos);
+                appendMacroDefinition(vulkan, VULKAN_BACKEND_MACRO, defines);
+                appendMacroDefinition(metal, METAL_BACKEND_MACRO, defines);
+                macrosDefined = true;
+            }
+            continue;
+        }
+
+        if (c == '/' && pos + 1 < size && source[pos + 1] == '/') {
+            //The newline itself is handled above
+            size_t end = source.find('\n', pos + 2);
+            pos = (end == std::string_view::npos ? size : end);
+            continue;
+        }
+
+        if (c == '/' && pos + 1 < size && source[pos + 1] == '*') {
+            size_t end = source.find("*/", pos + 2);
+            end = (end == std::string_view::npos ? size : end + 2);
+            for (size_t i = pos; i < end; i++)
+                line += (source[i] == '\n');
+            pos = end;
+            continue;
+        }
+
+        if (c == '"') {
+            pos++;
+            while (pos < size && source[pos] != '"' && source[pos] != '\n')
+                pos++;
+            if (pos < size && source[pos] == '"')
+                pos++;
+            continue;
+        }
+
+        if (c == '#') {
+            pos++;
+            while (pos < size && (source[pos] == ' ' || source[pos] == '\t'))
+                pos++;
+            if (!versionFound && matchesKeyword(source, pos, "version"))
+                versionFound = true;
+            continue;
+        }
+
+        if (!isIdentifierStart(c)) {
+            pos++;
+            continue;
+        }
+
+        size_t identifierStart = pos;
+        while (pos < size && isIdentifierChar(source[pos]))
+            pos++;
+        std::string_view identifier = source.substr(identifierStart, pos - identifierStart);
+
+        bool isLocation = (identifier == LOCATION_NAME);
+        bool isInputAttachment = (identifier == INPUT_ATTACHMENT_INDEX_NAME);
+        size_t indexStart, indexEnd;
+        if ((!isLocation && !isInputAttachment) || !parseAssignedIndex(source, pos, indexStart, indexEnd))
+            continue;
+
+        //Look for a ", color_attachment_index = N" right after the index
+        size_t colorIndexStart, colorIndexEnd;
+        bool hasColorAttachment = false;
+        size_t next = skipSpaces(source, indexEnd);
+        if (next < size && source[next] == ',') {
+            size_t qualifier = skipSpaces(source, next + 1);
+            if (matchesKeyword(source, qualifier, COLOR_ATTACHMENT_INDEX_NAME)) {
+                hasColorAttachment = parseAssignedIndex(source, qualifier + COLOR_ATTACHMENT_INDEX_NAME.size(), colorIndexStart, colorIndexEnd);
+            } else if (isInputAttachment && matchesKeyword(source, qualifier, DEPTH_ATTACHMENT_NAME)) {
+                throw error(line, "Depth attachment is not currently supported as an input attachment. To use it with the Vulkan backend, just make it a color attachment with random index");
+            }
+        }
+
+        if (!hasColorAttachment) {
+            if (isInputAttachment)
+                throw error(line, "Input attachment must have a color or depth attachment associated with it");
+            pos = indexEnd;
+            continue;
+        }
+
+        //Vulkan keeps the original index, Metal gets the color attachment index, and the qualifier is dropped from both
+        flush(indexStart);
+        vulkan.append(source.data() + indexStart, indexEnd - indexStart);
+        metal.append(source.data() + colorIndexStart, colorIndexEnd - colorIndexStart);
+        for (size_t i = indexEnd; i < colorIndexEnd; i++)
+            line += (source[i] == '\n');
+        pos = copyStart = colorIndexEnd;
+    }
+    flush(size);
+
+    if (!macrosDefined) {
+        if (versionFound) {
+            //#version on the last line, without a trailing newline
+            vulkan += '\n';
+            metal += '\n';
+            appendMacroDefinition(vulkan, VULKAN_BACKEND_MACRO, defines);
+            appendMacroDefinition(metal, METAL_BACKEND_MACRO, defines);
+        } else {
+            vulkan.insert(0, "#define " + std::string(VULKAN_BACKEND_MACRO) + "\n" + std::string(defines));
+            metal.insert(0, "#define " + std::string(METAL_BACKEND_MACRO) + "\n" + std::string(defines));
+        }
+    }
+}
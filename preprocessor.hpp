@@ -0,0 +1,58 @@
+#ifndef LV_PREPROCESSOR_H
+#define LV_PREPROCESSOR_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+const std::string_view INPUT_ATTACHMENT_INDEX_NAME = "input_attachment_index";
+const std::string_view COLOR_ATTACHMENT_INDEX_NAME = "color_attachment_index";
+const std::string_view DEPTH_ATTACHMENT_NAME = "depth_attachment";
+const std::string_view LOCATION_NAME = "location";
+
+const std::string_view VULKAN_BACKEND_MACRO = "LV_BACKEND_VULKAN";
+const std::string_view METAL_BACKEND_MACRO = "LV_BACKEND_METAL";
+
+const std::string_view PERMUTATION_PRAGMA = "lv_permutation";
+
+//Guards against a handful of axes silently turning into thousands of compiles
+const size_t MAX_SHADER_VARIANTS = 256;
+
+struct PreprocessedSource {
+    std::string vulkanSource;
+    std::string metalSource;
+};
+
+//One macro axis of a shader, declared in its source:
+//  #pragma lv_permutation SHADOWS              -> SHADOWS undefined or defined to 1
+//  #pragma lv_permutation MSAA_SAMPLES 1 2 4   -> MSAA_SAMPLES defined to each of the values
+struct PermutationAxis {
+    std::string name;
+    //Empty for an on/off axis
+    std::vector<std::string> values;
+};
+
+struct ShaderVariant {
+    //Canonical key: the axes sorted by name, "NAME" for an axis that is on and "NAME=value", separated by ';'.
+    //Axes that are off are left out, so the variant with every toggle off and no valued axes is "".
+    std::string name;
+    //#define lines for the preprocessor
+    std::string defines;
+};
+
+//Gathers the lv_permutation pragmas, sorted by name. Throws std::runtime_error on a malformed or duplicate axis.
+void parsePermutationAxes(std::string_view source, std::vector<PermutationAxis>& axes);
+
+//Every combination of the axes, a single unnamed variant without any. Throws std::runtime_error if there are more
+//than MAX_SHADER_VARIANTS.
+std::vector<ShaderVariant> expandPermutations(const std::vector<PermutationAxis>& axes);
+
+//Strips the "color_attachment_index" qualifiers and emits both backend variants in a single scan over the source:
+//  layout(location = 0, color_attachment_index = 2)          -> Vulkan: location = 0, Metal: location = 2
+//  layout(input_attachment_index = 1, color_attachment_index = 2) -> Vulkan: input_attachment_index = 1, Metal: 2
+//The backend macro and then `defines` are inserted right after the #version line. Comments and string literals are
+//copied verbatim. The output buffers are cleared but keep their capacity, so they can be reused across shaders.
+//Throws std::runtime_error on an input attachment without an associated color attachment.
+void preprocessGlslShader(std::string_view source, PreprocessedSource& output, std::string_view defines = {});
+
+#endif
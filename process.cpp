@@ -0,0 +1,31 @@
+#include "process.hpp"
+
+#include <cstdio>
+
+#ifdef WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+bool runCommand(const std::string& command, std::string& output) {
+    FILE* pipe = popen((command + " 2>&1").c_str(), "r");
+    if (!pipe) {
+        output += "Failed to run command: " + command + "\n";
+
+        return false;
+    }
+
+    char buffer[4096];
+    size_t readSize;
+    while ((readSize = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+        output.append(buffer, readSize);
+
+    int status = pclose(pipe);
+    if (status != 0) {
+        output += "Command failed (" + std::to_string(status) + "): " + command + "\n";
+
+        return false;
+    }
+
+    return true;
+}
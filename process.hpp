@@ -0,0 +1,10 @@
+#ifndef LV_PROCESS_H
+#define LV_PROCESS_H
+
+#include <string>
+
+//Runs a shell command, its stdout and stderr are captured into `output` instead of going
+//straight to the console, so that output from parallel jobs doesn't interleave
+bool runCommand(const std::string& command, std::string& output);
+
+#endif
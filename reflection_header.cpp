@@ -0,0 +1,262 @@
+#include "reflection_header.hpp"
+
+#include <cctype>
+#include <filesystem>
+
+namespace {
+
+//Identical in every generated header, the guard keeps it to a single definition per translation unit
+const char* REFLECTION_TYPES =
+R"(#ifndef LV_SHADER_REFLECTION_TYPES
+#define LV_SHADER_REFLECTION_TYPES
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace lv::reflection {
+
+inline constexpr uint32_t INVALID_INDEX = 0xffffffff;
+
+enum class Stage : uint32_t {
+    Vertex = 0,
+    Fragment = 1,
+    Compute = 2
+};
+
+enum class DescriptorType : uint32_t {
+    Buffer = 0,
+    CombinedImageSampler = 1,
+    Image = 2
+};
+
+enum class VertexInputType : uint32_t {
+    Float = 0,
+    Half = 1,
+    Int = 2,
+    UInt = 3
+};
+
+//Metal indices that don't apply to the descriptor type are INVALID_INDEX
+struct Binding {
+    uint32_t set;
+    uint32_t binding;
+    DescriptorType type;
+    uint32_t bufferIndex;
+    uint32_t textureIndex;
+    uint32_t samplerIndex;
+};
+
+//The location doubles as the Metal attribute index
+struct VertexInput {
+    uint32_t location;
+    VertexInputType type;
+    uint32_t componentCount;
+};
+
+struct Variant {
+    std::string_view name;
+    uint32_t payload;
+};
+
+//nullptr if the shader doesn't use the binding. Usable in static_assert and for template arguments, e.g.
+//findBinding(bindings, 0, 1)->bufferIndex
+template<size_t N>
+constexpr const Binding* findBinding(const std::array<Binding, N>& bindings, uint32_t set, uint32_t binding) {
+    for (const Binding& candidate : bindings) {
+        if (candidate.set == set && candidate.binding == binding)
+            return &candidate;
+    }
+
+    return nullptr;
+}
+
+template<size_t N>
+constexpr const VertexInput* findVertexInput(const std::array<VertexInput, N>& vertexInputs, uint32_t location) {
+    for (const VertexInput& candidate : vertexInputs) {
+        if (candidate.location == location)
+            return &candidate;
+    }
+
+    return nullptr;
+}
+
+} //namespace lv::reflection
+
+#endif
+)";
+
+const char* stageIdentifier(uint32_t stage) {
+    switch ((lv::ContainerStage)stage) {
+    case lv::ContainerStage::Vertex:
+        return "Vertex";
+    case lv::ContainerStage::Fragment:
+        return "Fragment";
+    case lv::ContainerStage::Compute:
+        return "Compute";
+    }
+
+    return "Vertex";
+}
+
+const char* stageNamespace(uint32_t stage) {
+    switch ((lv::ContainerStage)stage) {
+    case lv::ContainerStage::Vertex:
+        return "vertex";
+    case lv::ContainerStage::Fragment:
+        return "fragment";
+    case lv::ContainerStage::Compute:
+        return "compute";
+    }
+
+    return "vertex";
+}
+
+const char* descriptorTypeIdentifier(uint32_t descriptorType) {
+    switch ((lv::DescriptorType)descriptorType) {
+    case lv::DescriptorType::Buffer:
+        return "Buffer";
+    case lv::DescriptorType::CombinedImageSampler:
+        return "CombinedImageSampler";
+    case lv::DescriptorType::Image:
+        return "Image";
+    }
+
+    return "Buffer";
+}
+
+const char* vertexInputTypeIdentifier(uint32_t baseType) {
+    switch ((lv::VertexInputType)baseType) {
+    case lv::VertexInputType::Float:
+        return "Float";
+    case lv::VertexInputType::Half:
+        return "Half";
+    case lv::VertexInputType::Int:
+        return "Int";
+    case lv::VertexInputType::UInt:
+        return "UInt";
+    }
+
+    return "Float";
+}
+
+//C++20 keywords and alternative tokens, none of them can name a namespace
+const char* const RESERVED_WORDS[] = {
+    "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "break", "case", "catch", "char",
+    "char8_t", "char16_t", "char32_t", "class", "compl", "concept", "const", "consteval", "constexpr", "constinit",
+    "const_cast", "continue", "co_await", "co_return", "co_yield", "decltype", "default", "delete", "do", "double",
+    "dynamic_cast", "else", "enum", "explicit", "export", "extern", "false", "float", "for", "friend", "goto", "if",
+    "inline", "int", "long", "mutable", "namespace", "new", "noexcept", "not", "not_eq", "nullptr", "operator", "or",
+    "or_eq", "private", "protected", "public", "register", "reinterpret_cast", "requires", "return", "short", "signed",
+    "sizeof", "static", "static_assert", "static_cast", "struct", "switch", "template", "this", "thread_local", "throw",
+    "true", "try", "typedef", "typeid", "typename", "union", "unsigned", "using", "virtual", "void", "volatile",
+    "wchar_t", "while", "xor", "xor_eq"
+};
+
+//"sky/dome" -> "sky_dome", "2d-blit" -> "_2d_blit", "default" -> "default_"
+std::string identifier(std::string_view name) {
+    std::string result;
+    result.reserve(name.size() + 1);
+    if (name.empty() || std::isdigit((unsigned char)name[0]))
+        result += '_';
+    for (char c : name)
+        result += (std::isalnum((unsigned char)c) ? c : '_');
+    for (const char* reserved : RESERVED_WORDS) {
+        if (result == reserved)
+            return result + '_';
+    }
+
+    return result;
+}
+
+std::string stringLiteral(std::string_view str) {
+    std::string literal = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\')
+            literal += '\\';
+        literal += c;
+    }
+
+    return literal + "\"";
+}
+
+std::string index(uint32_t value) {
+    return value == lv::INVALID_BINDING ? std::string("lv::reflection::INVALID_INDEX") : std::to_string(value);
+}
+
+//Every array has at least the braces, std::array<T, 0> is valid too
+void appendLayout(std::string& out, const lv::ReflectionView& reflection, const lv::VertexInputsView& vertexInputs) {
+    out += "inline constexpr uint32_t pushConstantBufferIndex = " + index(reflection ? reflection.header->pushConstantBufferBinding : lv::INVALID_BINDING) + ";\n\n";
+
+    out += "//Highest binding + 1 of every descriptor set\n";
+    out += "inline constexpr std::array<uint32_t, " + std::to_string(reflection.setCount()) + "> setBindingCounts = {";
+    for (uint32_t set = 0; set < reflection.setCount(); set++)
+        out += (set == 0 ? "" : ", ") + std::to_string(reflection.setBindingCount(set));
+    out += "};\n\n";
+
+    out += "inline constexpr std::array<lv::reflection::Binding, " + std::to_string(reflection.bindingCount()) + "> bindings = {{\n";
+    for (uint32_t i = 0; i < reflection.bindingCount(); i++) {
+        const lv::BindingRecord& record = reflection.bindings[i];
+        out += "    {" + std::to_string(record.set) + ", " + std::to_string(record.binding) + ", lv::reflection::DescriptorType::" + descriptorTypeIdentifier(record.descriptorType) +
+            ", " + index(record.bufferBinding) + ", " + index(record.textureBinding) + ", " + index(record.samplerBinding) + "},\n";
+    }
+    out += "}};\n\n";
+
+    out += "inline constexpr std::array<lv::reflection::VertexInput, " + std::to_string(vertexInputs.count) + "> vertexInputs = {{\n";
+    for (uint32_t i = 0; i < vertexInputs.count; i++) {
+        const lv::VertexInputRecord& record = vertexInputs.records[i];
+        out += "    {" + std::to_string(record.location) + ", lv::reflection::VertexInputType::" + vertexInputTypeIdentifier(record.baseType) + ", " + std::to_string(record.componentCount) + "},\n";
+    }
+    out += "}};\n";
+}
+
+} //namespace
+
+std::string reflectionNamespace(uint32_t stage, std::string_view name) {
+    return "lv::shaders::" + std::string(stageNamespace(stage)) + "::" + identifier(name);
+}
+
+std::string generateReflectionHeader(const lv::ShaderContainerView& container, std::string_view name, std::string_view sourcePath) {
+    lv::ReflectionView reflection = container.reflection(0);
+    uint32_t stage = (reflection ? reflection.header->stage : 0);
+
+    std::string out = "//Generated by shader_compiler from '" + std::string(sourcePath) + "', do not edit\n";
+    out += "#pragma once\n\n";
+    out += REFLECTION_TYPES;
+    out += "\nnamespace " + reflectionNamespace(stage, name) + " {\n\n";
+    out += "inline constexpr std::string_view name = " + stringLiteral(name) + ";\n";
+    out += "inline constexpr lv::reflection::Stage stage = lv::reflection::Stage::" + std::string(stageIdentifier(stage)) + ";\n\n";
+    appendLayout(out, reflection, container.vertexInputs(0));
+
+    lv::VariantsView variants = container.variants();
+    if (variants) {
+        out += "\n//Sorted by the hash of the name, like the variants section\n";
+        out += "inline constexpr std::array<lv::reflection::Variant, " + std::to_string(variants.variantCount()) + "> variants = {{\n";
+        for (uint32_t i = 0; i < variants.variantCount(); i++)
+            out += "    {" + stringLiteral(variants.name(variants.records[i])) + ", " + std::to_string(variants.records[i].payloadIndex) + "},\n";
+        out += "}};\n";
+
+        for (uint32_t payload = 1; payload < variants.payloadCount(); payload++) {
+            out += "\nnamespace payload" + std::to_string(payload) + " {\n\n";
+            appendLayout(out, container.reflection(payload), container.vertexInputs(payload));
+            out += "\n} //namespace payload" + std::to_string(payload) + "\n";
+        }
+    }
+
+    out += "\n} //namespace " + reflectionNamespace(stage, name) + "\n";
+
+    return out;
+}
+
+std::string generateUmbrellaHeader(const std::vector<std::string>& includePaths) {
+    std::string out = "//Generated by shader_compiler, do not edit\n#pragma once\n\n";
+    for (auto& includePath : includePaths)
+        out += "#include " + stringLiteral(includePath) + "\n";
+
+    return out;
+}
+
+std::string reflectionHeaderPath(const std::string& outputPath) {
+    return std::filesystem::path(outputPath).replace_extension(".hpp").string();
+}
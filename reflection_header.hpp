@@ -0,0 +1,29 @@
+#ifndef LV_REFLECTION_HEADER_H
+#define LV_REFLECTION_HEADER_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "shader_container.hpp"
+
+//lv::shaders::<stage>::<name>, with the name turned into an identifier: "sky/dome" -> sky_dome, "default" -> default_.
+//Different names can end up the same, e.g. "sky/dome" and "sky_dome", the caller has to rule that out.
+std::string reflectionNamespace(uint32_t stage, std::string_view name);
+
+//C++17 header with the reflection of a compiled container as constexpr data, so that the engine can specialize its
+//pipeline layouts on it and check them with static_assert instead of reading the reflection at startup. Everything
+//lives in lv::shaders::<stage>::<name>: the push constant buffer index, the bindings with their Metal indices, the
+//binding count of every set and the vertex inputs. Payload 0 is at the top level, shaders with permutations add a
+//variants table and a payloadN namespace for every other payload. The types are shared by all generated headers and
+//only defined once.
+std::string generateReflectionHeader(const lv::ShaderContainerView& container, std::string_view name, std::string_view sourcePath);
+
+//Includes every given header, paths relative to the umbrella header
+std::string generateUmbrellaHeader(const std::vector<std::string>& includePaths);
+
+//compiled/vertex/sky/dome.lvsc -> compiled/vertex/sky/dome.hpp
+std::string reflectionHeaderPath(const std::string& outputPath);
+
+#endif
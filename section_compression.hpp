@@ -0,0 +1,282 @@
+#ifndef LV_SECTION_COMPRESSION_H
+#define LV_SECTION_COMPRESSION_H
+
+//Header-only decoder for compressed container and pack sections, SectionEntry::flags (PackSectionRef::flags in packs)
+//has SECTION_FLAG_COMPRESSED set for those. Only SPIR-V, metallib and the cross compiled sources are ever compressed.
+//
+//Layout (little endian):
+//  CompressedSectionHeader
+//  blocks                         uint32_t size followed by the block data
+//
+//Every block decodes to blockSize bytes (the last one to the rest) on its own, in the LZ4 block format. A block whose
+//size has STORED_BLOCK_FLAG set didn't get any smaller and is stored as is. Sections compressed with a dictionary
+//decode as if the dictionary preceded every block, so their matches can reach back into it. The dictionary isn't part
+//of the section: a pack carries its own, standalone containers need the file given to the compiler with --dictionary.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace lv {
+
+const uint32_t SECTION_FLAG_COMPRESSED = 1;
+//Every flag this reader understands, sections with any other flag set are rejected
+const uint32_t KNOWN_SECTION_FLAGS = SECTION_FLAG_COMPRESSED;
+const uint32_t STORED_BLOCK_FLAG = 0x80000000;
+const uint32_t COMPRESSED_BLOCK_SIZE = 65536;
+//LZ4 offsets are 16 bit, matches can't reach further back than this into the dictionary
+const size_t MAX_DICTIONARY_SIZE = 65535;
+
+enum class SectionCodec : uint32_t {
+    Lz4 = 1
+};
+
+struct CompressedSectionHeader {
+    uint32_t codec;
+    uint32_t blockSize;
+    uint64_t uncompressedSize;
+    //XXH64 of the dictionary, 0 for sections compressed without one
+    uint64_t dictionaryHash;
+};
+static_assert(sizeof(CompressedSectionHeader) == 24, "CompressedSectionHeader must be 24 bytes");
+
+//nullptr if the section is too small to hold the header
+inline const CompressedSectionHeader* compressedSectionHeader(const void* data, size_t size) {
+    return size >= sizeof(CompressedSectionHeader) ? static_cast<const CompressedSectionHeader*>(data) : nullptr;
+}
+
+//Decodes one LZ4 block, which has to fill `dst` exactly. Never reads or writes out of bounds, whatever the input.
+inline bool decodeLz4Block(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize, const uint8_t* dictionary, size_t dictionarySize) {
+    const uint8_t* ip = src;
+    const uint8_t* srcEnd = src + srcSize;
+    uint8_t* op = dst;
+    uint8_t* dstEnd = dst + dstSize;
+
+    //15 in the token means the length continues in the following bytes, up to and including the first one below 255
+    auto readLength = [&](size_t& length) {
+        if (length != 15)
+            return true;
+        uint8_t byte;
+        do {
+            if (ip == srcEnd)
+                return false;
+            byte = *ip++;
+            length += byte;
+        } while (byte == 255);
+
+        return true;
+    };
+
+    while (ip < srcEnd) {
+        uint8_t token = *ip++;
+        size_t literalLength = token >> 4;
+        if (!readLength(literalLength) || literalLength > (size_t)(srcEnd - ip) || literalLength > (size_t)(dstEnd - op))
+            return false;
+        //Short runs are copied as one fixed 16 byte chunk where both buffers have room for it, the bytes written past the
+        //run are overwritten by what follows it
+        if (literalLength <= 16 && srcEnd - ip >= 16 && dstEnd - op >= 16)
+            memcpy(op, ip, 16);
+        else
+            memcpy(op, ip, literalLength);
+        op += literalLength;
+        ip += literalLength;
+
+        //The last sequence has no match
+        if (ip == srcEnd)
+            break;
+        if (srcEnd - ip < 2)
+            return false;
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t matchLength = token & 15;
+        if (offset == 0 || !readLength(matchLength))
+            return false;
+        matchLength += 4;
+        if (matchLength > (size_t)(dstEnd - op))
+            return false;
+
+        //The part of the match in the dictionary, a match may continue from its end into the block
+        size_t produced = op - dst;
+        if (offset > produced) {
+            size_t dictionaryOffset = offset - produced;
+            if (dictionaryOffset > dictionarySize)
+                return false;
+            size_t count = std::min(dictionaryOffset, matchLength);
+            memcpy(op, dictionary + dictionarySize - dictionaryOffset, count);
+            op += count;
+            matchLength -= count;
+        }
+
+        //Chunks no larger than the offset never read bytes they are about to write, so a match is copied a chunk at a
+        //time as long as the destination has room for the last one. Anything else, e.g. an overlapping match repeating a
+        //short pattern, goes one byte at a time.
+        const uint8_t* match = op - offset;
+        size_t chunkSize = (offset >= 16 ? 16 : offset >= 8 ? 8 : 0);
+        if (chunkSize > 0 && (size_t)(dstEnd - op) >= matchLength + chunkSize - 1) {
+            for (size_t i = 0; i < matchLength; i += chunkSize)
+                memcpy(op + i, match + i, chunkSize);
+        } else if (offset >= matchLength) {
+            memcpy(op, match, matchLength);
+        } else {
+            for (size_t i = 0; i < matchLength; i++)
+                op[i] = match[i];
+        }
+        op += matchLength;
+    }
+
+    return op == dstEnd;
+}
+
+//Streams a section into caller provided memory. Every block that fits in the rest of the destination is decoded
+//straight into it, only a block split across two read() calls goes through an internal buffer. Sections without
+//SECTION_FLAG_COMPRESSED pass through unchanged, so every section can be read the same way.
+class SectionDecoder {
+public:
+    //The section and the dictionary have to stay alive as long as the decoder is used. The dictionary has to be the one
+    //the section was compressed with, CompressedSectionHeader::dictionaryHash is its XXH64 to check against.
+    bool open(const void* data, size_t size, bool compressed, const void* dictionary = nullptr, size_t dictionarySize = 0) {
+        next = static_cast<const uint8_t*>(data);
+        end = next + size;
+        this->compressed = compressed;
+        this->dictionary = static_cast<const uint8_t*>(dictionary);
+        this->dictionarySize = dictionarySize;
+        position = 0;
+        stagedSize = stagedPosition = 0;
+        error = false;
+        if (!compressed) {
+            blockSize = 0;
+            uncompressedSize = size;
+            return true;
+        }
+
+        const CompressedSectionHeader* header = compressedSectionHeader(data, size);
+        if (!header || header->codec != (uint32_t)SectionCodec::Lz4 || header->blockSize == 0 || header->blockSize >= STORED_BLOCK_FLAG ||
+            (header->dictionaryHash != 0 && dictionarySize == 0)) {
+            error = true;
+            uncompressedSize = 0;
+            return false;
+        }
+        blockSize = header->blockSize;
+        uncompressedSize = header->uncompressedSize;
+        next += sizeof(CompressedSectionHeader);
+        //Only the last 64 KB of a larger dictionary are in reach
+        if (this->dictionarySize > MAX_DICTIONARY_SIZE) {
+            this->dictionary += this->dictionarySize - MAX_DICTIONARY_SIZE;
+            this->dictionarySize = MAX_DICTIONARY_SIZE;
+        }
+
+        return true;
+    }
+
+    //Uncompressed size of the whole section
+    uint64_t size() const {
+        return uncompressedSize;
+    }
+
+    uint64_t remaining() const {
+        return uncompressedSize - position;
+    }
+
+    //Corrupt input, or a section compressed with a dictionary that wasn't given
+    bool failed() const {
+        return error;
+    }
+
+    //Decodes up to `capacity` bytes into `dst`, returns the number of bytes written: less than `capacity` only at the
+    //end of the section or on failure
+    size_t read(void* dst, size_t capacity) {
+        uint8_t* out = static_cast<uint8_t*>(dst);
+        size_t written = 0;
+        while (written < capacity && !error) {
+            //Whatever didn't fit into the previous call
+            if (stagedPosition < stagedSize) {
+                size_t count = std::min(capacity - written, stagedSize - stagedPosition);
+                memcpy(out + written, staging.get() + stagedPosition, count);
+                stagedPosition += count;
+                written += count;
+                position += count;
+                continue;
+            }
+            if (position == uncompressedSize)
+                break;
+
+            if (!compressed) {
+                size_t count = (size_t)std::min<uint64_t>(capacity - written, remaining());
+                memcpy(out + written, next + position, count);
+                written += count;
+                position += count;
+                continue;
+            }
+
+            size_t blockOutSize = (size_t)std::min<uint64_t>(blockSize, remaining());
+            if (capacity - written >= blockOutSize) {
+                if (!decodeBlock(out + written, blockOutSize))
+                    break;
+                written += blockOutSize;
+                position += blockOutSize;
+            } else {
+                if (!staging)
+                    staging.reset(new uint8_t[blockSize]);
+                if (!decodeBlock(staging.get(), blockOutSize))
+                    break;
+                stagedSize = blockOutSize;
+                stagedPosition = 0;
+            }
+        }
+
+        return written;
+    }
+
+    //Decodes the rest of the section into `dst`, which has to hold remaining() bytes
+    bool readAll(void* dst) {
+        size_t count = (size_t)remaining();
+
+        return read(dst, count) == count && !error;
+    }
+
+private:
+    const uint8_t* next = nullptr;
+    const uint8_t* end = nullptr;
+    bool compressed = false;
+    const uint8_t* dictionary = nullptr;
+    size_t dictionarySize = 0;
+    uint32_t blockSize = 0;
+    uint64_t uncompressedSize = 0;
+    uint64_t position = 0;
+    std::unique_ptr<uint8_t[]> staging;
+    size_t stagedSize = 0;
+    size_t stagedPosition = 0;
+    bool error = false;
+
+    bool decodeBlock(uint8_t* dst, size_t dstSize) {
+        uint32_t storedSize;
+        if (end - next < (ptrdiff_t)sizeof(storedSize)) {
+            error = true;
+            return false;
+        }
+        memcpy(&storedSize, next, sizeof(storedSize));
+        next += sizeof(storedSize);
+
+        size_t dataSize = storedSize & ~STORED_BLOCK_FLAG;
+        if (dataSize > (size_t)(end - next)) {
+            error = true;
+            return false;
+        }
+        if (storedSize & STORED_BLOCK_FLAG) {
+            error = (dataSize != dstSize);
+            if (!error)
+                memcpy(dst, next, dataSize);
+        } else {
+            error = !decodeLz4Block(next, dataSize, dst, dstSize, dictionary, dictionarySize);
+        }
+        next += dataSize;
+
+        return !error;
+    }
+};
+
+} //namespace lv
+
+#endif
@@ -0,0 +1,235 @@
+#include "section_compressor.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "hash.hpp"
+
+namespace {
+
+//See the LZ4 block format: matches are at least 4 bytes, the last 5 bytes are always literals and the last match has
+//to start at least 12 bytes before the end of the block
+const size_t MIN_MATCH = 4;
+const size_t LAST_LITERALS = 5;
+const size_t MATCH_FIND_LIMIT = 12;
+const size_t MAX_OFFSET = 65535;
+
+const uint32_t HASH_LOG = 15;
+const uint32_t EMPTY_POSITION = 0xffffffff;
+
+//Training: dictionary segments and the sequences they are scored by, both word aligned
+const size_t SEGMENT_SIZE = 64;
+const size_t SEQUENCE_SIZE = 8;
+const size_t SEQUENCE_STEP = 4;
+
+uint32_t read32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint64_t read64(const uint8_t* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint32_t hashSequence(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_LOG);
+}
+
+//Lengths of 15 and up continue in extra bytes of 255 each, ended by a byte below 255
+void appendLength(std::string& out, size_t length) {
+    for (; length >= 255; length -= 255)
+        out += (char)255;
+    out += (char)length;
+}
+
+//`matchLength` is 0 for the last sequence, which only has literals
+void appendSequence(std::string& out, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength) {
+    size_t matchCode = (matchLength > 0 ? matchLength - MIN_MATCH : 0);
+    out += (char)((std::min<size_t>(literalLength, 15) << 4) | std::min<size_t>(matchCode, 15));
+    if (literalLength >= 15)
+        appendLength(out, literalLength - 15);
+    out.append(reinterpret_cast<const char*>(literals), literalLength);
+    if (matchLength == 0)
+        return;
+
+    out += (char)(offset & 0xff);
+    out += (char)(offset >> 8);
+    if (matchCode >= 15)
+        appendLength(out, matchCode - 15);
+}
+
+} //namespace
+
+SectionCompressor::SectionCompressor(std::string_view dictionary) : dictionaryTable(1u << HASH_LOG, EMPTY_POSITION) {
+    if (dictionary.size() > lv::MAX_DICTIONARY_SIZE)
+        dictionary.remove_prefix(dictionary.size() - lv::MAX_DICTIONARY_SIZE);
+    dictionaryData = dictionary;
+    if (dictionaryData.empty())
+        return;
+
+    dictionaryHashValue = hashBytes(dictionaryData.data(), dictionaryData.size());
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(dictionaryData.data());
+    for (size_t position = 0; position + MIN_MATCH <= dictionaryData.size(); position++)
+        dictionaryTable[hashSequence(read32(data + position))] = (uint32_t)position;
+}
+
+std::string SectionCompressor::compress(const void* data, size_t size) const {
+    std::string out;
+    Scratch scratch;
+    compress(data, size, out, scratch);
+
+    return out;
+}
+
+void SectionCompressor::compress(const void* data, size_t size, std::string& out, Scratch& scratch) const {
+    lv::CompressedSectionHeader header{};
+    header.codec = (uint32_t)lv::SectionCodec::Lz4;
+    header.blockSize = lv::COMPRESSED_BLOCK_SIZE;
+    header.uncompressedSize = size;
+    header.dictionaryHash = dictionaryHashValue;
+
+    out.assign(reinterpret_cast<const char*>(&header), sizeof(header));
+    std::string& block = scratch.block;
+    for (size_t offset = 0; offset < size; offset += lv::COMPRESSED_BLOCK_SIZE) {
+        const uint8_t* blockData = static_cast<const uint8_t*>(data) + offset;
+        size_t blockSize = std::min<size_t>(size - offset, lv::COMPRESSED_BLOCK_SIZE);
+        block.clear();
+        compressBlock(blockData, blockSize, block, scratch);
+
+        //Incompressible blocks, e.g. already compressed data in a metallib, cost 4 bytes instead of growing
+        bool stored = (block.size() >= blockSize);
+        uint32_t storedSize = (stored ? (uint32_t)blockSize | lv::STORED_BLOCK_FLAG : (uint32_t)block.size());
+        out.append(reinterpret_cast<const char*>(&storedSize), sizeof(storedSize));
+        if (stored)
+            out.append(reinterpret_cast<const char*>(blockData), blockSize);
+        else
+            out += block;
+    }
+}
+
+void SectionCompressor::compressBlock(const uint8_t* data, size_t size, std::string& out, Scratch& scratch) const {
+    //The dictionary goes right in front of the block, so a match into it is just a longer offset
+    std::string& windowData = scratch.window;
+    windowData.assign(dictionaryData);
+    windowData.append(reinterpret_cast<const char*>(data), size);
+    const uint8_t* window = reinterpret_cast<const uint8_t*>(windowData.data());
+    std::vector<uint32_t>& table = scratch.table;
+    table.assign(dictionaryTable.begin(), dictionaryTable.end());
+
+    size_t start = dictionaryData.size();
+    size_t end = windowData.size();
+    size_t anchor = start;
+    if (size > MATCH_FIND_LIMIT) {
+        size_t matchLimit = end - LAST_LITERALS;
+        size_t lastMatchStart = end - MATCH_FIND_LIMIT;
+        size_t position = start;
+        while (position <= lastMatchStart) {
+            uint32_t sequence = read32(window + position);
+            uint32_t& slot = table[hashSequence(sequence)];
+            size_t candidate = slot;
+            slot = (uint32_t)position;
+            if (candidate == EMPTY_POSITION || position - candidate > MAX_OFFSET || read32(window + candidate) != sequence) {
+                //Moves faster through data that doesn't match anything
+                position += 1 + ((position - anchor) >> 6);
+                continue;
+            }
+
+            size_t length = MIN_MATCH;
+            while (position + length < matchLimit && window[candidate + length] == window[position + length])
+                length++;
+            while (position > anchor && candidate > 0 && window[position - 1] == window[candidate - 1]) {
+                position--;
+                candidate--;
+                length++;
+            }
+
+            appendSequence(out, window + anchor, position - anchor, position - candidate, length);
+            position += length;
+            anchor = position;
+            //Lets the next match start right where this one ended
+            if (position <= lastMatchStart)
+                table[hashSequence(read32(window + position - 2))] = (uint32_t)(position - 2);
+        }
+    }
+
+    appendSequence(out, window + anchor, end - anchor, 0, 0);
+}
+
+std::string trainDictionary(const std::vector<std::string_view>& samples, size_t maxSize) {
+    maxSize = std::min(maxSize, lv::MAX_DICTIONARY_SIZE);
+
+    //Number of samples every sequence appears in, counted once per sample
+    std::unordered_map<uint64_t, uint32_t> frequencies;
+    size_t totalSize = 0;
+    for (auto sample : samples) {
+        if (sample.size() < SEGMENT_SIZE)
+            continue;
+        totalSize += sample.size();
+        std::unordered_set<uint64_t> seen;
+        for (size_t position = 0; position + SEQUENCE_SIZE <= sample.size(); position += SEQUENCE_STEP) {
+            uint64_t sequence = read64(reinterpret_cast<const uint8_t*>(sample.data()) + position);
+            if (seen.insert(sequence).second)
+                frequencies[sequence]++;
+        }
+    }
+
+    size_t segmentCount = maxSize / SEGMENT_SIZE;
+    if (segmentCount == 0 || totalSize == 0)
+        return {};
+
+    //Sequences found in a single sample don't help compressing any other, and those already in the dictionary no longer
+    //count, so every segment adds something new
+    auto score = [&](const uint8_t* segment) {
+        uint64_t total = 0;
+        for (size_t position = 0; position + SEQUENCE_SIZE <= SEGMENT_SIZE; position += SEQUENCE_STEP) {
+            auto it = frequencies.find(read64(segment + position));
+            if (it != frequencies.end() && it->second > 1)
+                total += it->second;
+        }
+
+        return total;
+    };
+
+    //Like COVER: the samples are split into one epoch per segment, and the best scoring segment of each epoch is kept
+    std::string dictionary;
+    const uint8_t* best = nullptr;
+    uint64_t bestScore = 0;
+    auto keepBest = [&]() {
+        if (!best || dictionary.size() + SEGMENT_SIZE > maxSize)
+            return;
+        dictionary.append(reinterpret_cast<const char*>(best), SEGMENT_SIZE);
+        for (size_t position = 0; position + SEQUENCE_SIZE <= SEGMENT_SIZE; position += SEQUENCE_STEP)
+            frequencies[read64(best + position)] = 0;
+        best = nullptr;
+        bestScore = 0;
+    };
+
+    size_t epochSize = std::max(totalSize / segmentCount, SEGMENT_SIZE);
+    size_t sampleStart = 0;
+    size_t epochEnd = epochSize;
+    for (auto sample : samples) {
+        if (sample.size() < SEGMENT_SIZE)
+            continue;
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(sample.data());
+        for (size_t position = 0; position + SEGMENT_SIZE <= sample.size(); position += SEQUENCE_STEP) {
+            while (sampleStart + position >= epochEnd) {
+                keepBest();
+                epochEnd += epochSize;
+            }
+            uint64_t segmentScore = score(data + position);
+            if (segmentScore > bestScore) {
+                best = data + position;
+                bestScore = segmentScore;
+            }
+        }
+        sampleStart += sample.size();
+    }
+    keepBest();
+
+    return dictionary;
+}
@@ -0,0 +1,57 @@
+#ifndef LV_SECTION_COMPRESSOR_H
+#define LV_SECTION_COMPRESSOR_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "section_compression.hpp"
+
+//Dictionary size unless training is asked for a different one, plenty for the shared declarations of SPIR-V modules
+const size_t DEFAULT_DICTIONARY_SIZE = 32 * 1024;
+
+//Compresses section payloads into the format SectionDecoder reads, with a greedy single probe LZ4 matcher. The
+//dictionary is hashed once up front, compress() is const and can be called from several threads at once.
+class SectionCompressor {
+public:
+    //Buffers of a single compress() call, kept by the caller to compress the next section without allocating
+    struct Scratch {
+        std::string window;
+        std::vector<uint32_t> table;
+        std::string block;
+    };
+
+    //Anything beyond lv::MAX_DICTIONARY_SIZE is cut off at the front
+    explicit SectionCompressor(std::string_view dictionary = {});
+
+    const std::string& dictionary() const {
+        return dictionaryData;
+    }
+
+    //XXH64 of the dictionary, 0 without one
+    uint64_t dictionaryHash() const {
+        return dictionaryHashValue;
+    }
+
+    //Header and blocks, the caller keeps the section uncompressed if this doesn't come out smaller
+    std::string compress(const void* data, size_t size) const;
+
+    //Same, into `out`, whose memory is reused like that of the scratch
+    void compress(const void* data, size_t size, std::string& out, Scratch& scratch) const;
+
+private:
+    std::string dictionaryData;
+    uint64_t dictionaryHashValue = 0;
+    //Hash table with the dictionary positions already in it, every block starts from a copy
+    std::vector<uint32_t> dictionaryTable;
+
+    void compressBlock(const uint8_t* data, size_t size, std::string& out, Scratch& scratch) const;
+};
+
+//Picks the byte sequences shared by most samples, e.g. the SPIR-V of every shader in a build, until the dictionary
+//reaches maxSize. Candidate segments are word aligned, like SPIR-V. Returns an empty string if the samples have
+//nothing in common.
+std::string trainDictionary(const std::vector<std::string_view>& samples, size_t maxSize = DEFAULT_DICTIONARY_SIZE);
+
+#endif
@@ -1,7 +1,21 @@
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <filesystem>
 #include <fstream>
+#include <limits>
 #include <sstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <span>
+#include <stdexcept>
+#include <string_view>
 #include <sys/types.h>
 #include <sys/stat.h>
 #ifndef WIN32
@@ -12,489 +26,1614 @@
 #define stat _stat
 #endif
 
-#include <json/json.h>
+#include "build_cache.hpp"
+#include "file_utils.hpp"
+#include "file_watcher.hpp"
+#include "frontend.hpp"
+#include "hash.hpp"
+#include "cross_compiler.hpp"
+#include "memory_stats.hpp"
+#include "preprocessor.hpp"
+#include "process.hpp"
+#include "reflection_header.hpp"
+#include "section_compressor.hpp"
+#include "shader_container.hpp"
+#include "shader_container_writer.hpp"
+#include "shader_pack_writer.hpp"
+#include "source_scanner.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+//The whole argument has to be a number no larger than `max`, so that e.g. a size in MB can still be turned into bytes
+template<typename T>
+bool parseNumberArgument(const std::string& str, T& value, T max = std::numeric_limits<T>::max()) {
+    T parsed;
+    auto result = std::from_chars(str.data(), str.data() + str.size(), parsed);
+    if (result.ec != std::errc() || result.ptr != str.data() + str.size() || parsed > max)
+        return false;
+    value = parsed;
+
+    return true;
+}
+
+//How long the watch mode waits for a burst of saves to settle before rebuilding
+const uint32_t WATCH_DEBOUNCE_MS = 100;
+
+//Length of the slowest shader list in the timing summary
+const size_t SLOWEST_SHADER_COUNT = 10;
+
+//Most shaders handed to a single metal compiler invocation in batched mode, keeps the command line short
+const size_t METAL_BATCH_SIZE = 64;
+
+//Size limit of the artifact cache unless --cache-max-size says otherwise
+const uint64_t DEFAULT_CACHE_MAX_SIZE_MB = 2048;
+
+//Pessimistic peak of a job for --max-memory. The base covers what a job holds regardless of its source: the frontend's
+//symbol tables and pool, the spirv_cross compiler objects and the worker's scratch buffers, a few MB together. The
+//per byte part assumes the SPIR-V is up to 4x the GLSL, the parsed IR up to 4x the SPIR-V, and up to 4 live copies of
+//that IR (the parse plus one per extra cross compile target), 4 * 4 * 4 = 64. Check them against the Peak RSS +MB of
+//the stages in --timings, compileShaders() warns about any job that doesn't fit the budget on its own.
+const uint64_t JOB_MEMORY_BASE = 8 * 1024 * 1024;
+const uint64_t JOB_MEMORY_PER_SOURCE_BYTE = 64;
+
+BuildTrace trace;
+
+BuildManifest manifest;
+uint64_t settingsHash = 0;
+//Defaults to <shader directory>/.temp/cache, --cache-dir or LV_SHADER_CACHE_DIR share it across checkouts
+ArtifactCache artifactCache;
+//--max-memory, unlimited by default
+MemoryBudget memoryBudget;
+
+std::unique_ptr<GlslFrontend> frontend;
+std::string compilerPath = "/Users/samuliak/VulkanSDK/1.3.236.0/macOS/bin/glslc";
+std::string metalCompilerCommand = "xcrun -sdk macosx metal -gline-tables-only -frecord-sources";
+std::string metallibCommand = "xcrun -sdk macosx metallib";
+//Batched Metal mode: the AIR of every shader is kept in metalDir and linked into one library per stage
+bool batchMetal = false;
+std::string metalDir;
+//Writes <output>.d next to every compiled shader
+bool writeDepfiles = false;
+//Writes <output>.hpp with the reflection as constexpr data next to every compiled shader, and one next to the pack
+bool writeReflectionHeaders = false;
+//Namespace of every shader's header -> its source, kept across watch mode rebuilds
+std::map<std::string, std::string> reflectionNamespaces;
+//Section types picked with --compress, compressed with the dictionary given with --dictionary if there is one
+std::vector<lv::SectionType> compressedSectionTypes;
+SectionCompressor sectionCompressor;
+CrossCompileOptions crossCompileOptions;
+
+std::string includeSource =
+"#extension GL_AMD_gpu_shader_half_float: enable\n"
+"#define float2 vec2\n"
+"#define float3 vec3\n"
+"#define float4 vec4\n"
+"#define float3x3 mat3\n"
+"#define float4x4 mat4\n"
+"#define half float16_t\n"
+"#define half2 f16vec2\n"
+"#define half3 f16vec3\n"
+"#define half4 f16vec4\n"
+"#define half3x3 f16mat3\n"
+"#define half4x4 f16mat4";
 
-namespace nh = nlohmann;
+struct ShaderJob {
+    ShaderStage stage;
+    std::string sourceDir;
+    std::string filename;
+    std::string name;
+    std::string relPath;
+    std::string outputPath;
+    ShaderRecord record;
+
+    //Filled in by the worker
+    std::string log;
+    bool succeeded = false;
+    double parseMs = 0.0;
+    double irCopyMs = 0.0;
+    //Batched Metal mode: the MSL written for compileMetalBatches(), one per payload
+    std::vector<std::string> metalSources;
+};
+
+//Every shader with a readable source, whether it has to be rebuilt or not. Used to assemble the pack.
+struct ShaderOutput {
+    ShaderStage stage;
+    std::string name;
+    std::string relPath;
+    std::string outputPath;
+    uint64_t key;
+};
 
-#include "spirv_msl.hpp"
+//Keyed by the relative source path, so the pack is always assembled in the same order
+using ShaderOutputs = std::map<std::string, ShaderOutput>;
+
+struct StageDirectory {
+    ShaderStage stage;
+    std::string sourceDir;
+    std::string compiledDir;
+};
 
-bool isNumber(const std::string & s) {
-    return !s.empty() && std::all_of(s.begin(), s.end(), ::isdigit);
+//Shaders live anywhere below <shader directory>/source, the outputs mirror them below <shader directory>/compiled
+const std::string SOURCE_DIR = "source";
+const std::string COMPILED_DIR = "compiled";
+
+const char* stageFolderName(ShaderStage stage) {
+    switch (stage) {
+    case ShaderStage::Vertex:
+        return "vertex";
+    case ShaderStage::Fragment:
+        return "fragment";
+    case ShaderStage::Compute:
+        return "compute";
+    }
+
+    return "unknown";
 }
 
-std::vector<uint32_t> readFile(const char* path) {
-	FILE *file = fopen(path, "rb");
-	if (!file) {
-		std::cerr << "Failed to open file: " << path << std::endl;
+std::vector<StageDirectory> stageDirectories(const std::string& directory) {
+    std::vector<StageDirectory> stageDirs;
+    for (ShaderStage stage : {ShaderStage::Vertex, ShaderStage::Fragment, ShaderStage::Compute})
+        stageDirs.push_back({stage, directory + "/" + SOURCE_DIR + "/" + stageFolderName(stage), directory + "/" + COMPILED_DIR + "/" + stageFolderName(stage)});
 
-		return {};
-	}
+    return stageDirs;
+}
 
-	fseek(file, 0, SEEK_END);
-	long len = ftell(file) / sizeof(uint32_t);
-	rewind(file);
+//The stage comes from the extension (.vert, .frag, .comp) or else from the closest directory named after a stage
+std::optional<ShaderStage> shaderStageFromPath(const std::string& path) {
+    std::filesystem::path sourcePath(path);
+    std::string extension = sourcePath.extension().string();
+    for (ShaderStage stage : {ShaderStage::Vertex, ShaderStage::Fragment, ShaderStage::Compute}) {
+        if (extension == std::string(".") + shaderStageName(stage))
+            return stage;
+    }
+    for (std::filesystem::path dir = sourcePath.parent_path(); !dir.empty() && dir != dir.parent_path(); dir = dir.parent_path()) {
+        for (ShaderStage stage : {ShaderStage::Vertex, ShaderStage::Fragment, ShaderStage::Compute}) {
+            if (dir.filename() == stageFolderName(stage))
+                return stage;
+        }
+    }
+
+    return std::nullopt;
+}
 
-	std::vector<uint32_t> fileData(len);
-	if (fread(fileData.data(), sizeof(uint32_t), len, file) != size_t(len))
-		fileData.clear();
+//A shader found by the scan. source/vertex/sky/dome.vert is compiled to compiled/vertex/sky/dome.lvsc and named
+//"sky/dome" in the pack, so a flat stage directory keeps the names it always had.
+struct ShaderSource {
+    ShaderStage stage;
+    std::string relPath;
+    std::string name;
+    std::string outputPath;
+};
 
-	fclose(file);
+//Files below source/ without a stage, e.g. shared includes, are not shaders
+std::optional<ShaderSource> shaderSourceFromPath(const std::string& relPath) {
+    if (relPath.size() <= SOURCE_DIR.size() || relPath.compare(0, SOURCE_DIR.size() + 1, SOURCE_DIR + "/") != 0)
+        return std::nullopt;
+    std::optional<ShaderStage> stage = shaderStageFromPath(relPath);
+    if (!stage)
+        return std::nullopt;
 
-	return fileData;
+    std::string pathInSource = std::filesystem::path(relPath.substr(SOURCE_DIR.size() + 1)).replace_extension().generic_string();
+    std::string stageFolder = std::string(stageFolderName(*stage)) + "/";
+    std::string name = (pathInSource.rfind(stageFolder, 0) == 0 ? pathInSource.substr(stageFolder.size()) : pathInSource);
+
+    return ShaderSource{*stage, relPath, name, manifest.absolutePath(COMPILED_DIR + "/" + pathInSource + ".lvsc")};
 }
 
-std::string readFileStr(const char* filename) {
-    std::string content;
-    std::ifstream file;
-    // ensure ifstream objects can throw exceptions:
-    file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    try {
-        // open files
-        file.open(filename);
-        std::stringstream stream;
-        // read file's buffer contents into streams
-        stream << file.rdbuf();
-        // close file handlers
-        file.close();
-        // convert stream into string
-        content = stream.str();
+//AIR and MSL are named after the cache key and the payload, so an unchanged shader always finds its AIR from the last build
+std::string metalIntermediateName(uint64_t key, uint32_t payload) {
+    return hashToHex(key) + "_" + std::to_string(payload);
+}
+
+std::string metalIntermediatePath(uint64_t key, uint32_t payload, const char* extension) {
+    return metalDir + "/" + metalIntermediateName(key, payload) + extension;
+}
+
+//Shared by all shaders of a stage, next to the stage's compiled directory: compiled/vertex.metallib
+std::string metalLibraryName(ShaderStage stage) {
+    return std::string(stageFolderName(stage)) + ".metallib";
+}
+
+//Unique within the library: the sanitized file name plus a hash of the path, so that e.g. blur.frag and blur.glsl don't
+//collide, and the payload for all but the first permutation
+std::string metalFunctionName(const std::string& relPath, uint32_t payload) {
+    std::string name = std::filesystem::path(relPath).stem().string();
+    for (char& c : name) {
+        if (!std::isalnum((unsigned char)c))
+            c = '_';
     }
-    catch(std::ifstream::failure e) {
-        std::cout << "Error: could not open file '" << filename << "'" << std::endl;
+
+    name += "_" + hashToHex(hashString(relPath)).substr(0, 8);
+
+    return (payload == 0 ? name : name + "_" + std::to_string(payload));
+}
+
+std::string depfilePath(const std::string& outputPath) {
+    return outputPath + ".d";
+}
+
+//Make syntax, spaces and '#' escaped with a backslash, '$' doubled
+std::string escapeDepfilePath(const std::string& path) {
+    std::string escaped;
+    escaped.reserve(path.size());
+    for (char c : path) {
+        if (c == ' ' || c == '#')
+            escaped += '\\';
+        else if (c == '$')
+            escaped += '$';
+        escaped += c;
     }
 
-    return content;
+    return escaped;
 }
 
-void writeFile(const char* path, const char* string) {
-	FILE *file = fopen(path, "w");
-	if (!file) {
-		std::cerr << "Failed to write file: " << path << std::endl;
-	}
+//"<output>: <source> <includes>", which both Make and Ninja understand. The includes are the transitive set the cache
+//key was computed from, so lava_common.glsl is part of it as well.
+bool writeDepfile(const std::string& path, const std::string& outputPath, const std::string& relPath, const ShaderRecord& record) {
+    std::string text = escapeDepfilePath(outputPath) + ": " + escapeDepfilePath(manifest.absolutePath(relPath));
+    for (auto& include : record.includes)
+        text += " \\\n  " + escapeDepfilePath(manifest.absolutePath(include.path));
+    text += "\n";
 
-	fprintf(file, "%s", string);
-	fclose(file);
+    return writeFileBytes(path.c_str(), text.data(), text.size());
 }
 
-struct PushConstant {
-    //std::string name;
-    uint32_t outBufferBinding;
-};
+//Only written if it changed, so that the engine sources including it are not rebuilt for nothing. The container is read
+//back from `outputPath` unless it is passed in.
+bool writeReflectionHeader(const std::string& outputPath, const std::string& name, const std::string& relPath, std::string_view containerData = {}) {
+    lv::MappedFile file;
+    if (containerData.empty()) {
+        if (!file.open(outputPath.c_str()))
+            return false;
+        containerData = std::string_view(static_cast<const char*>(file.data()), file.size());
+    }
+    lv::ShaderContainerView container;
+    if (!container.open(containerData.data(), containerData.size()))
+        return false;
 
-struct BufferBinding {
-    //std::string name;
-    uint32_t inSet;
-    uint32_t inBinding;
-    uint32_t outBufferBinding;
-};
+    std::string headerPath = reflectionHeaderPath(outputPath);
+    std::string header = generateReflectionHeader(container, name, relPath);
+    std::string oldHeader;
+    if (readFileBytes(headerPath.c_str(), oldHeader) && oldHeader == header)
+        return true;
 
-struct SampledImageBinding {
-    //std::string name;
-    uint32_t inSet;
-    uint32_t inBinding;
-    uint32_t outTextureBinding;
-    uint32_t outSamplerBinding;
-};
+    return writeFileBytes(headerPath.c_str(), header.data(), header.size());
+}
 
-struct ImageBinding {
-    //std::string name;
-    uint32_t inSet;
-    uint32_t inBinding;
-    uint32_t outTextureBinding;
+//The stage library is linked from the AIR of every shader, a shader without its AIR has to be compiled again
+bool metalAirMissing(uint64_t key) {
+    return batchMetal && !std::filesystem::exists(metalIntermediatePath(key, 0, ".air"));
+}
+
+enum class ShaderState {
+    Unreadable,
+    UpToDate,
+    Stale
 };
 
-nh::json compileSpirvToMSL(std::string tempDir, std::string spirvSrcFile) {
-    std::vector<uint32_t> spirvBinary = readFile(spirvSrcFile.c_str());
-    auto movedSpirvBinary = std::move(spirvBinary);
-
-    //MSL
-	spirv_cross::CompilerMSL msl(movedSpirvBinary);
-
-	// Set some options.
-	spirv_cross::CompilerMSL::Options options = msl.get_msl_options();
-    //options.platform = spirv_cross::CompilerMSL::Options::Platform::macOS;
-    options.msl_version = spirv_cross::CompilerMSL::Options::make_msl_version(3, 0);
-    options.use_framebuffer_fetch_subpasses = true;
-	msl.set_msl_options(options);
-
-	std::string mslSource = msl.compile();
-
-    writeFile((tempDir + "/temp.metal").c_str(), mslSource.c_str());
-    //std::cout << "METAL SOURCE:\n\n" << mslSource << "\n\n\n\n" << std::endl;
-
-    //GLSL
-    /*
-	spirv_cross::CompilerGLSL glsl(movedSpirvBinary);
-    
-    spirv_cross::CompilerGLSL::Options options;
-    options.version = 410;
-    options.emit_push_constant_as_uniform_buffer = true;
-    options.enable_420pack_extension = false;
-    //Does not work on Apple devices for some reason
-    //options.separate_shader_objects = true;
-    glsl.set_common_options(options);
-
-	std::string glslSource = glsl.compile();
-
-    writeFile((tempDir + "/temp.glsl").c_str(), glslSource.c_str());
-    */
-
-    //Bindings
-    PushConstant* pushConstant = nullptr;
-    std::vector<BufferBinding> bufferBindings;
-    std::vector<SampledImageBinding> sampledImageBindings;
-    std::vector<ImageBinding> imageBindings;
-
-	spirv_cross::ShaderResources resources = msl.get_shader_resources();
-
-	for (auto& resource : resources.push_constant_buffers) {
-        //auto& glslResource = glsl.get_shader_resources().push_constant_buffers[0];
-        //std::cout << glsl.get_name(glslResource.id) << std::endl;
-        pushConstant = new PushConstant{
-            //glslResource.name,
-            msl.get_automatic_msl_resource_binding(resource.id)
-        };
-    }
-
-    for (auto& resource : resources.uniform_buffers) {
-        BufferBinding uniformBufferBinding{
-            //resource.name,
-            msl.get_decoration(resource.id, spv::DecorationDescriptorSet),
-            msl.get_decoration(resource.id, spv::DecorationBinding),
-            msl.get_automatic_msl_resource_binding(resource.id)
-        };
-
-        /*
-        spirv_cross::MSLResourceBinding resBinding;
-        resBinding.stage = spv::ExecutionModelFragment;
-        resBinding.desc_set = set;
-        resBinding.binding = binding;
-        resBinding.msl_buffer = uniformBufferBinding.outBufferBinding;
-
-        msl.add_msl_resource_binding(resBinding);
-        */
-
-        bufferBindings.push_back(uniformBufferBinding);
-    }
-
-    for (auto& resource : resources.storage_buffers) {
-        BufferBinding storageSpaceBufferBinding{
-            msl.get_decoration(resource.id, spv::DecorationDescriptorSet),
-            msl.get_decoration(resource.id, spv::DecorationBinding),
-            msl.get_automatic_msl_resource_binding(resource.id)
-        };
-
-        bufferBindings.push_back(storageSpaceBufferBinding);
-    }
-
-	for (auto& resource : resources.sampled_images) {
-        SampledImageBinding sampledImageBinding{
-            //resource.name,
-            msl.get_decoration(resource.id, spv::DecorationDescriptorSet),
-            msl.get_decoration(resource.id, spv::DecorationBinding),
-            msl.get_automatic_msl_resource_binding(resource.id),
-            msl.get_automatic_msl_resource_binding_secondary(resource.id)
-        };
-        
-        /*
-        spirv_cross::MSLResourceBinding resBinding;
-        resBinding.stage = spv::ExecutionModelFragment;
-        resBinding.desc_set = set;
-        resBinding.binding = binding;
-        resBinding.msl_texture = sampledImageBinding.outTextureBinding;
-        resBinding.msl_sampler = sampledImageBinding.outSamplerBinding;
-
-        msl.add_msl_resource_binding(resBinding);
-        */
-
-        sampledImageBindings.push_back(sampledImageBinding);
-	}
-
-	for (auto& resource : resources.storage_images) {
-        ImageBinding imageBinding{
-            msl.get_decoration(resource.id, spv::DecorationDescriptorSet),
-            msl.get_decoration(resource.id, spv::DecorationBinding),
-            msl.get_automatic_msl_resource_binding(resource.id)
-        };
-
-        imageBindings.push_back(imageBinding);
-	}
-
-    for (auto& resource : resources.subpass_inputs) {
-        ImageBinding imageBinding{
-            //resource.name,
-            msl.get_decoration(resource.id, spv::DecorationDescriptorSet),
-            msl.get_decoration(resource.id, spv::DecorationBinding),
-            msl.get_automatic_msl_resource_binding(resource.id)
-        };
-
-        imageBindings.push_back(imageBinding);
-    }
-
-    //Write the shader resource file
-    nh::json shaderJSON;
-
-    shaderJSON["stage"] = "unknown";
-
-    if (pushConstant != nullptr) {
-        //JSON["pushConstant"]["name"] = pushConstant->name;
-        shaderJSON["pushConstant"]["bufferBinding"] = pushConstant->outBufferBinding;
-    }
-    
-    shaderJSON["maxSet"] = "-1";
-
-#define UPDATE_DESCRIPTOR_SET_MAX_BINDING(inSet, inBinding) \
-auto& descriptorSets = shaderJSON["descriptorSets"]; \
-std::string maxSet = "0"; \
-if (descriptorSets.contains("maxSet")) \
-    maxSet = descriptorSets["maxSet"]; \
-shaderJSON["maxSet"] = std::to_string(std::max((uint32_t)stoi(maxSet), inSet)); \
-auto& descriptorSet = descriptorSets[std::to_string(inSet)]; \
-std::string maxBinding = "0"; \
-if (descriptorSet.contains("maxBinding")) \
-    maxBinding = descriptorSet["maxBinding"]; \
-descriptorSet["maxBinding"] = std::to_string(std::max((uint32_t)stoi(maxBinding), inBinding)); \
-auto& binding = descriptorSet["bindings"][std::to_string(inBinding)];
-
-    for (auto& bufferBinding : bufferBindings) {
-        UPDATE_DESCRIPTOR_SET_MAX_BINDING(bufferBinding.inSet, bufferBinding.inBinding);
-        //binding["name"] = bufferBinding.name;
-        binding["descriptorType"] = "buffer";
-        binding["bufferBinding"] = bufferBinding.outBufferBinding;
-    }
-
-    for (auto& sampledImageBinding : sampledImageBindings) {
-        UPDATE_DESCRIPTOR_SET_MAX_BINDING(sampledImageBinding.inSet, sampledImageBinding.inBinding);
-        //binding["name"] = sampledImageBinding.name;
-        binding["descriptorType"] = "combinedImageSampler";
-        binding["textureBinding"] = sampledImageBinding.outTextureBinding;
-        binding["samplerBinding"] = sampledImageBinding.outSamplerBinding;
-    }
+//Computes the cache key of a shader and registers its output. Only stats and hashes, nothing is compiled or written.
+ShaderState checkShader(const ShaderSource& source, ShaderOutputs& outputs, ShaderRecord& record) {
+    const std::string& relPath = source.relPath;
+    const std::string& outputPath = source.outputPath;
+    if (!manifest.computeShaderKey(relPath, (uint32_t)source.stage, settingsHash, record))
+        return ShaderState::Unreadable;
+    //The function name in the shared library is derived from the path, so the output is no longer path independent
+    if (batchMetal)
+        record.key = hashCombine(record.key, hashString(relPath));
+
+    outputs[relPath] = {source.stage, source.name, relPath, outputPath, record.key};
+
+    auto oldRecord = manifest.shaders.find(relPath);
+    if (oldRecord != manifest.shaders.end()) {
+        oldRecord->second.seen = true;
+        if (oldRecord->second.key == record.key && std::filesystem::exists(outputPath) && !metalAirMissing(record.key))
+            return ShaderState::UpToDate;
+    }
+
+    return ShaderState::Stale;
+}
+
+//Two shaders of a stage whose names map to the same namespace, e.g. sky/dome.frag and sky_dome.frag, would be defined
+//twice by the umbrella header. The first one in path order keeps the namespace, the other one is left out of the build.
+bool claimReflectionNamespace(const ShaderSource& source) {
+    std::string name = reflectionNamespace((uint32_t)source.stage, source.name);
+    auto [owner, inserted] = reflectionNamespaces.emplace(name, source.relPath);
+    if (inserted || owner->second == source.relPath)
+        return true;
+
+    std::cout << "Error: '" << source.relPath << "' and '" << owner->second << "' both generate " << name << ", rename one of them" << std::endl;
+
+    return false;
+}
+
+void releaseReflectionNamespace(const ShaderSource& source) {
+    auto owner = reflectionNamespaces.find(reflectionNamespace((uint32_t)source.stage, source.name));
+    if (owner != reflectionNamespaces.end() && owner->second == source.relPath)
+        reflectionNamespaces.erase(owner);
+}
 
-    for (auto& imageBinding : imageBindings) {
-        UPDATE_DESCRIPTOR_SET_MAX_BINDING(imageBinding.inSet, imageBinding.inBinding);
-        //binding["name"] = imageBinding.name;
-        binding["descriptorType"] = "image";
-        binding["textureBinding"] = imageBinding.outTextureBinding;
-    }
-
-    return shaderJSON;
-}
-
-const std::string INPUT_ATTACHMENT_INDEX_NAME = "input_attachment_index";
-const std::string COLOR_ATTACHMENT_INDEX_NAME = "color_attachment_index";
-const std::string DEPTH_ATTACHMENT_NAME = "depth_attachment";
-const std::string LOCATION_NAME = "location";
-
-struct MappedAttachment {
-    uint32_t index;
-    size_t pos;
+//Queues a job if the cache key of the shader changed. Returns true if the shader had to be compiled or restored
+bool collectShaderJob(const ShaderSource& source, std::vector<ShaderJob>& jobs, ShaderOutputs& outputs) {
+    if (writeReflectionHeaders && !claimReflectionNamespace(source))
+        return false;
+
+    ShaderRecord record;
+    ShaderState state = checkShader(source, outputs, record);
+    if (state == ShaderState::Unreadable)
+        return false;
+
+    const std::string& relPath = source.relPath;
+    const std::string& outputPath = source.outputPath;
+    std::filesystem::path sourcePath(manifest.absolutePath(relPath));
+    std::string filename = sourcePath.filename().string();
+    if (state == ShaderState::UpToDate) {
+        if (writeDepfiles && !std::filesystem::exists(depfilePath(outputPath)))
+            writeDepfile(depfilePath(outputPath), outputPath, relPath, record);
+        if (writeReflectionHeaders && !std::filesystem::exists(reflectionHeaderPath(outputPath)))
+            writeReflectionHeader(outputPath, source.name, relPath);
+        return false;
+    }
+
+    //Nested source directories don't need a matching compiled directory up front
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(outputPath).parent_path(), error);
+
+    //Built before with exactly the same inputs, no need to invoke any tool
+    TraceScope restoreScope(trace, "cache.restore", relPath);
+    if (!metalAirMissing(record.key) && artifactCache.restore(record.key, outputPath)) {
+        std::cout << "Restored '" << filename << "' from cache" << std::endl;
+        if (writeDepfiles)
+            writeDepfile(depfilePath(outputPath), outputPath, relPath, record);
+        if (writeReflectionHeaders)
+            writeReflectionHeader(outputPath, source.name, relPath);
+        manifest.shaders[relPath] = std::move(record);
+        return true;
+    }
+
+    ShaderJob job;
+    job.stage = source.stage;
+    job.sourceDir = sourcePath.parent_path().string();
+    job.filename = filename;
+    job.name = source.name;
+    job.relPath = relPath;
+    job.outputPath = outputPath;
+    job.record = std::move(record);
+    jobs.push_back(std::move(job));
+
+    return true;
+}
+
+//Every shader below source/. The scan is sorted, so the job order (and therefore the console output) does not depend
+//on the directory iteration order. Returns false if there is no source directory.
+bool listShaderSources(SourceScanner& scanner, std::vector<ShaderSource>& sources) {
+    TraceScope scanScope(trace, "scan");
+    std::vector<std::string> relPaths;
+    if (!scanner.scan(SOURCE_DIR, relPaths))
+        return false;
+
+    for (auto& relPath : relPaths) {
+        std::optional<ShaderSource> source = shaderSourceFromPath(relPath);
+        if (source)
+            sources.push_back(std::move(*source));
+    }
+
+    return true;
+}
+
+//Gathers the shaders whose cache key changed
+void collectShaderJobs(SourceScanner& scanner, std::vector<ShaderJob>& jobs, ShaderOutputs& outputs) {
+    std::vector<ShaderSource> sources;
+    if (!listShaderSources(scanner, sources)) {
+        std::cout << "No such file or directory '" << manifest.absolutePath(SOURCE_DIR) << "'" << std::endl;
+        return;
+    }
+
+    bool compiled = false;
+    for (auto& source : sources)
+        compiled |= collectShaderJob(source, jobs, outputs);
+    if (!compiled) {
+        std::cout << "Nothing to do for '" << manifest.absolutePath(SOURCE_DIR) << "'" << std::endl;
+    }
+}
+
+//Watch mode: only the changed shaders and the shaders that include a changed file are looked at. Shaders that
+//failed last time are retried as well, the change might have been the missing include or the fix for the error.
+//A changed directory affects every shader below it, e.g. all of them are removed if it was deleted.
+//Returns false if none of the changes affect any shader.
+bool collectChangedShaderJobs(const std::vector<std::string>& changedPaths, std::vector<ShaderJob>& jobs, ShaderOutputs& outputs) {
+    std::set<std::string> affected;
+    for (auto& path : changedPaths) {
+        std::string relPath = manifest.relativePath(path);
+        if (shaderSourceFromPath(relPath))
+            affected.insert(relPath);
+        for (auto output = outputs.lower_bound(relPath + "/"); output != outputs.end() && output->first.rfind(relPath + "/", 0) == 0; output++)
+            affected.insert(output->first);
+        for (auto& [shaderPath, record] : manifest.shaders) {
+            for (auto& include : record.includes) {
+                if (include.path == relPath)
+                    affected.insert(shaderPath);
+            }
+        }
+    }
+    for (auto& [relPath, output] : outputs) {
+        auto record = manifest.shaders.find(relPath);
+        if (record == manifest.shaders.end() || record->second.key != output.key)
+            affected.insert(relPath);
+    }
+
+    bool changed = false;
+    for (auto& relPath : affected) {
+        std::optional<ShaderSource> source = shaderSourceFromPath(relPath);
+        if (!source)
+            continue;
+
+        std::error_code error;
+        if (std::filesystem::is_regular_file(manifest.absolutePath(relPath), error)) {
+            changed |= collectShaderJob(*source, jobs, outputs);
+        } else if (outputs.erase(relPath) > 0) {
+            //Its outputs would otherwise outlive it, the pack is rewritten without it
+            std::filesystem::remove(source->outputPath, error);
+            std::filesystem::remove(depfilePath(source->outputPath), error);
+            std::filesystem::remove(reflectionHeaderPath(source->outputPath), error);
+            releaseReflectionNamespace(*source);
+            std::cout << "Removed '" << relPath << "'" << std::endl;
+            manifest.shaders.erase(relPath);
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+//xcrun only works with files, so this is the one stage that has to go through the disk
+bool compileMetalLibrary(std::string_view mslSource, const std::string& scratchDir, std::string_view shaderName, std::string& metallib, std::string& log) {
+    std::string metalPath = scratchDir + "/temp.metal";
+    std::string airPath = scratchDir + "/temp.air";
+    std::string metallibPath = scratchDir + "/temp.metallib";
+
+    if (!writeFileBytes(metalPath.c_str(), mslSource.data(), mslSource.size()))
+        return false;
+
+    {
+        TraceScope metalScope(trace, "xcrun.metal", shaderName);
+        if (!runCommand(metalCompilerCommand + " -c " + metalPath + " -o " + airPath, log))
+            return false;
+    }
+    {
+        TraceScope metallibScope(trace, "xcrun.metallib", shaderName);
+        if (!runCommand(metallibCommand + " " + airPath + " -o " + metallibPath, log))
+            return false;
+    }
+
+    if (!readFileBytes(metallibPath.c_str(), metallib)) {
+        log += "Error: could not read '" + metallibPath + "'\n";
+        return false;
+    }
+
+    return true;
+}
+
+//Flattens all bindings into a single table sorted by set and binding and builds the dense per set slot tables,
+//see shader_container.hpp
+void serializeReflection(const ShaderReflection& reflection, ShaderStage stage, std::string& data) {
+    std::vector<lv::BindingRecord> records;
+    records.reserve(reflection.bufferBindings.size() + reflection.sampledImageBindings.size() + reflection.imageBindings.size());
+    for (auto& bufferBinding : reflection.bufferBindings)
+        records.push_back({bufferBinding.inSet, bufferBinding.inBinding, (uint32_t)lv::DescriptorType::Buffer, bufferBinding.outBufferBinding, lv::INVALID_BINDING, lv::INVALID_BINDING});
+    for (auto& sampledImageBinding : reflection.sampledImageBindings)
+        records.push_back({sampledImageBinding.inSet, sampledImageBinding.inBinding, (uint32_t)lv::DescriptorType::CombinedImageSampler, lv::INVALID_BINDING, sampledImageBinding.outTextureBinding, sampledImageBinding.outSamplerBinding});
+    for (auto& imageBinding : reflection.imageBindings)
+        records.push_back({imageBinding.inSet, imageBinding.inBinding, (uint32_t)lv::DescriptorType::Image, lv::INVALID_BINDING, imageBinding.outTextureBinding, lv::INVALID_BINDING});
+    std::sort(records.begin(), records.end(), [](const lv::BindingRecord& a, const lv::BindingRecord& b) {
+        return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+    });
+
+    //Records are sorted, so the highest set and the highest binding of every set are known in a single pass
+    uint32_t setCount = (records.empty() ? 0 : records.back().set + 1);
+    std::vector<lv::DescriptorSetRecord> sets(setCount, lv::DescriptorSetRecord{0, 0});
+    for (auto& record : records)
+        sets[record.set].slotCount = record.binding + 1;
+    uint32_t slotCount = 0;
+    for (auto& set : sets) {
+        set.firstSlot = slotCount;
+        slotCount += set.slotCount;
+    }
+    std::vector<uint32_t> slots(slotCount, lv::INVALID_BINDING);
+    for (uint32_t i = 0; i < records.size(); i++)
+        slots[sets[records[i].set].firstSlot + records[i].binding] = i;
+
+    lv::ReflectionHeader header{};
+    header.stage = (uint32_t)stage;
+    header.pushConstantBufferBinding = (reflection.pushConstant ? reflection.pushConstant->outBufferBinding : lv::INVALID_BINDING);
+    header.bindingCount = (uint32_t)records.size();
+    header.setCount = setCount;
+
+    data.assign((const char*)&header, sizeof(header));
+    data.append((const char*)records.data(), records.size() * sizeof(lv::BindingRecord));
+    data.append((const char*)sets.data(), sets.size() * sizeof(lv::DescriptorSetRecord));
+    data.append((const char*)slots.data(), slots.size() * sizeof(uint32_t));
+}
+
+//Already sorted by location, see crossCompileSpirv()
+void serializeVertexInputs(const ShaderReflection& reflection, std::vector<lv::VertexInputRecord>& records) {
+    records.clear();
+    for (auto& vertexInput : reflection.vertexInputs) {
+        lv::VertexInputType baseType = lv::VertexInputType::Float;
+        if (vertexInput.baseType == VertexInputBaseType::Half)
+            baseType = lv::VertexInputType::Half;
+        else if (vertexInput.baseType == VertexInputBaseType::Int)
+            baseType = lv::VertexInputType::Int;
+        else if (vertexInput.baseType == VertexInputBaseType::UInt)
+            baseType = lv::VertexInputType::UInt;
+        records.push_back({vertexInput.location, (uint32_t)baseType, vertexInput.componentCount});
+    }
+}
+
+//See shader_container.hpp
+std::string serializeMetalFunction(std::string_view library, std::string_view function) {
+    lv::MetalFunctionHeader header{(uint32_t)library.size(), (uint32_t)function.size()};
+
+    std::string data;
+    data.reserve(sizeof(header) + library.size() + function.size());
+    data.append((const char*)&header, sizeof(header));
+    data.append(library);
+    data.append(function);
+
+    return data;
+}
+
+//Sorted by key, see shader_container.hpp
+std::string serializeVariants(const std::vector<ShaderVariant>& variants, const std::vector<uint32_t>& payloadIndices, uint32_t payloadCount) {
+    std::vector<lv::VariantRecord> records;
+    records.reserve(variants.size());
+    std::string names;
+    for (size_t i = 0; i < variants.size(); i++) {
+        records.push_back({lv::variantKeyHash(variants[i].name), payloadIndices[i], (uint32_t)names.size(), (uint32_t)variants[i].name.size(), 0});
+        names += variants[i].name;
+    }
+    std::sort(records.begin(), records.end(), [](const lv::VariantRecord& a, const lv::VariantRecord& b) {
+        return a.key < b.key;
+    });
+    for (size_t i = 1; i < records.size(); i++) {
+        if (records[i].key == records[i - 1].key)
+            throw std::runtime_error("two permutations have the same variant key");
+    }
+
+    lv::VariantsHeader header{(uint32_t)records.size(), payloadCount};
+
+    std::string data;
+    data.reserve(sizeof(header) + records.size() * sizeof(lv::VariantRecord) + names.size());
+    data.append((const char*)&header, sizeof(header));
+    data.append((const char*)records.data(), records.size() * sizeof(lv::VariantRecord));
+    data.append(names);
+
+    return data;
+}
+
+//Distinct output of a shader, shared by every variant whose SPIR-V came out the same
+struct ShaderPayload {
+    uint64_t spirvHash = 0;
+    std::vector<uint32_t> spirv;
+    //The module the Metal and the other cross compiled targets came from, kept to tell hash collisions apart
+    std::vector<uint32_t> crossSpirv;
+    CrossCompileOutput crossOutput;
+    //The metal function section in batched Metal mode
+    std::string metallib;
 };
 
-struct PreprocessedSource {
-    std::string source;
-    std::vector<MappedAttachment> mappedAttachments;
+//Buffers owned by a worker and reused for every shader it compiles. In watch mode they survive across rebuilds.
+struct WorkerScratch {
+    std::string glslSource;
+    std::vector<PermutationAxis> axes;
+    PreprocessedSource preprocessed;
+    std::vector<uint32_t> spirv1;
+    std::vector<uint32_t> spirv2;
+    //Only the first payloadCount are in use, the rest keep their buffers for the next shader
+    std::vector<ShaderPayload> payloads;
+
+    //Container assembly, indexed by payload like the payloads. compressedData only ever grows, the writer keeps
+    //pointers into it until the container is finished.
+    std::vector<std::string> reflectionData;
+    std::vector<std::vector<lv::VertexInputRecord>> vertexInputData;
+    std::vector<std::string> compressedData;
+    SectionCompressor::Scratch compression;
+    ShaderContainerWriter writer;
+    std::string output;
+
+    //Memory held on to by the large buffers, the small ones don't matter
+    uint64_t retainedBytes() const {
+        uint64_t bytes = glslSource.capacity() + preprocessed.vulkanSource.capacity() + preprocessed.metalSource.capacity() +
+            (spirv1.capacity() + spirv2.capacity()) * sizeof(uint32_t) + compression.window.capacity() + compression.block.capacity() +
+            compression.table.capacity() * sizeof(uint32_t) + output.capacity();
+        for (auto& payload : payloads) {
+            bytes += (payload.spirv.capacity() + payload.crossSpirv.capacity()) * sizeof(uint32_t) + payload.metallib.capacity();
+            bytes += payload.crossOutput.msl.capacity() + payload.crossOutput.glsl.capacity() + payload.crossOutput.hlsl.capacity();
+        }
+        for (auto& data : compressedData)
+            bytes += data.capacity();
+
+        return bytes;
+    }
 };
 
-PreprocessedSource preprocessGlslShader(std::string filename) {
-    PreprocessedSource source;
-    source.source = readFileStr(filename.c_str());
+//Reflection, SPIR-V and metallib sections plus the sources of the optional targets for every payload, indexed by payload,
+//assembled in the worker's buffers and written out at once. `variantsData` is empty for shaders without permutations.
+const std::string& buildShaderOutput(std::span<const ShaderPayload> payloads, std::string_view variantsData, ShaderStage stage, WorkerScratch& scratch) {
+    if (scratch.reflectionData.size() < payloads.size()) {
+        scratch.reflectionData.resize(payloads.size());
+        scratch.vertexInputData.resize(payloads.size());
+    }
+    //Sized up front, so no string moves while the writer points into them
+    size_t compressedCount = 0;
+    if (scratch.compressedData.size() < payloads.size() * compressedSectionTypes.size())
+        scratch.compressedData.resize(payloads.size() * compressedSectionTypes.size());
+
+    ShaderContainerWriter& writer = scratch.writer;
+    writer.clear();
+    //Sections selected with --compress stay uncompressed if compression doesn't make them any smaller
+    auto addPayloadSection = [&](lv::SectionType type, uint32_t index, const void* data, size_t size) {
+        if (std::find(compressedSectionTypes.begin(), compressedSectionTypes.end(), type) != compressedSectionTypes.end()) {
+            std::string& compressed = scratch.compressedData[compressedCount];
+            sectionCompressor.compress(data, size, compressed, scratch.compression);
+            if (compressed.size() < size) {
+                compressedCount++;
+                writer.addSection(type, index, compressed.data(), compressed.size(), lv::CONTAINER_PAYLOAD_ALIGNMENT, lv::SECTION_FLAG_COMPRESSED);
+                return;
+            }
+        }
+        writer.addSection(type, index, data, size);
+    };
+
+    for (uint32_t i = 0; i < payloads.size(); i++) {
+        const ShaderPayload& payload = payloads[i];
+        std::string& reflectionData = scratch.reflectionData[i];
+        serializeReflection(payload.crossOutput.reflection, stage, reflectionData);
+        writer.addSection(lv::SectionType::Reflection, i, reflectionData.data(), reflectionData.size());
+        std::vector<lv::VertexInputRecord>& vertexInputData = scratch.vertexInputData[i];
+        serializeVertexInputs(payload.crossOutput.reflection, vertexInputData);
+        if (!vertexInputData.empty())
+            writer.addSection(lv::SectionType::VertexInputs, i, vertexInputData.data(), vertexInputData.size() * sizeof(lv::VertexInputRecord));
+        addPayloadSection(lv::SectionType::SpirV, i, payload.spirv.data(), payload.spirv.size() * sizeof(uint32_t));
+        if (batchMetal)
+            writer.addSection(lv::SectionType::MetalFunction, i, payload.metallib.data(), payload.metallib.size());
+        else
+            addPayloadSection(lv::SectionType::Metallib, i, payload.metallib.data(), payload.metallib.size());
+        if (crossCompileOptions.glsl.enabled)
+            addPayloadSection(lv::SectionType::GlslSource, i, payload.crossOutput.glsl.data(), payload.crossOutput.glsl.size());
+        if (crossCompileOptions.hlsl.enabled)
+            addPayloadSection(lv::SectionType::HlslSource, i, payload.crossOutput.hlsl.data(), payload.crossOutput.hlsl.size());
+    }
+    if (!variantsData.empty())
+        writer.addSection(lv::SectionType::Variants, 0, variantsData.data(), variantsData.size());
+
+    writer.finish(scratch.output);
 
-    //Gather and remove all the aditional information from the shader
-    size_t pos = 0;
-    while (true) {
-        pos = source.source.find(LOCATION_NAME, pos);
+    return scratch.output;
+}
 
-        if (pos == std::string::npos)
-            break;
+//Every job works in its own scratch directory, so no two jobs ever touch the same temporary file. The source is read
+//once, every permutation is preprocessed and compiled from it, and only variants with new SPIR-V are cross compiled.
+void compileShader(ShaderJob& job, std::string jobTempDir, WorkerScratch& scratch) {
+    std::string log;
+    std::string filename = job.filename;
+    std::string_view shaderName = job.relPath;
+    log += "Compiling '" + filename + "'\n";
 
-        pos = source.source.find_first_not_of(" =", pos + LOCATION_NAME.size());
-        std::string locationIndexStr = source.source.substr(pos, 1);
-        if (!isNumber(locationIndexStr))
+    TraceScope shaderScope(trace, SHADER_TRACE_STAGE, shaderName);
+    try {
+        std::filesystem::create_directories(jobTempDir);
+
+        std::string sourcePath = job.sourceDir + "/" + filename;
+        std::string& glslSource = scratch.glslSource;
+        {
+            TraceScope readScope(trace, "read", shaderName);
+            if (!readFileBytes(sourcePath.c_str(), glslSource)) {
+                job.log = log + "Error: could not open file '" + sourcePath + "'\n";
+                return;
+            }
+        }
+
+        std::vector<ShaderVariant> variants;
+        {
+            TraceScope permutationScope(trace, "permutations", shaderName);
+            parsePermutationAxes(glslSource, scratch.axes);
+            variants = expandPermutations(scratch.axes);
+        }
+
+        std::vector<uint32_t> payloadIndices(variants.size());
+        uint32_t payloadCount = 0;
+        for (size_t variantIndex = 0; variantIndex < variants.size(); variantIndex++) {
+            const ShaderVariant& variant = variants[variantIndex];
+            std::string variantLog = (scratch.axes.empty() ? "" : "In variant '" + variant.name + "'\n");
+
+            PreprocessedSource& preprocessed = scratch.preprocessed;
+            {
+                TraceScope preprocessScope(trace, "preprocess", shaderName);
+                preprocessGlslShader(glslSource, preprocessed, variant.defines);
+            }
+
+            std::vector<uint32_t>& spirv1 = scratch.spirv1;
+            std::vector<uint32_t>& spirv2 = scratch.spirv2;
+            {
+                TraceScope frontendScope(trace, "frontend.vulkan", shaderName);
+                if (!frontend->compile({preprocessed.vulkanSource, job.stage, sourcePath, jobTempDir, "temp1"}, spirv1, variantLog)) {
+                    job.log = log + variantLog;
+                    return;
+                }
+            }
+            {
+                TraceScope frontendScope(trace, "frontend.metal", shaderName);
+                if (!frontend->compile({preprocessed.metalSource, job.stage, sourcePath, jobTempDir, "temp2"}, spirv2, variantLog)) {
+                    job.log = log + variantLog;
+                    return;
+                }
+            }
+
+            //Both modules the same means every output is the same, the variant just points at the existing payload. The hash
+            //only narrows it down, the modules themselves are compared like ShaderPackWriter::addBlob() does.
+            uint64_t spirvHash = hashCombine(hashBytes(spirv1.data(), spirv1.size() * sizeof(uint32_t)), hashBytes(spirv2.data(), spirv2.size() * sizeof(uint32_t)));
+            auto existing = std::find_if(scratch.payloads.begin(), scratch.payloads.begin() + payloadCount, [&](const ShaderPayload& payload) {
+                return payload.spirvHash == spirvHash && payload.spirv == spirv1 && payload.crossSpirv == spirv2;
+            });
+            if (existing != scratch.payloads.begin() + payloadCount) {
+                payloadIndices[variantIndex] = (uint32_t)(existing - scratch.payloads.begin());
+                continue;
+            }
+
+            if (scratch.payloads.size() == payloadCount)
+                scratch.payloads.emplace_back();
+            ShaderPayload& payload = scratch.payloads[payloadCount];
+            payload.spirvHash = spirvHash;
+            std::swap(payload.spirv, spirv1);
+
+            //std::string metalSourcePath = metalSourceDir + "/" + filenameStem + ".metal";
+            //std::string openglSourcePath = openglSourceDir + "/" + filenameStem + ".glsl";
+            if (batchMetal) {
+                CrossCompileOptions options = crossCompileOptions;
+                options.msl.entryPointName = metalFunctionName(job.relPath, payloadCount);
+                payload.crossOutput = crossCompileSpirv(spirv2, options, trace, shaderName);
+            } else {
+                payload.crossOutput = crossCompileSpirv(spirv2, crossCompileOptions, trace, shaderName);
+            }
+            job.parseMs += payload.crossOutput.parseMs;
+            job.irCopyMs += payload.crossOutput.irCopyMs;
+            std::swap(payload.crossSpirv, spirv2);
+
+            //Batched mode only leaves the MSL behind, compileMetalBatches() turns it into AIR together with all the others
+            if (batchMetal) {
+                std::string metalPath = metalIntermediatePath(job.record.key, payloadCount, ".metal");
+                if (!writeFileBytes(metalPath.c_str(), payload.crossOutput.msl.data(), payload.crossOutput.msl.size())) {
+                    job.log = log + "Error: could not write '" + metalPath + "'\n";
+                    return;
+                }
+                job.metalSources.push_back(metalIntermediateName(job.record.key, payloadCount));
+                payload.metallib = serializeMetalFunction(metalLibraryName(job.stage), metalFunctionName(job.relPath, payloadCount));
+            } else if (!compileMetalLibrary(payload.crossOutput.msl, jobTempDir, shaderName, payload.metallib, variantLog)) {
+                job.log = log + variantLog;
+                return;
+            }
+
+            payloadIndices[variantIndex] = payloadCount++;
+        }
+        if (!scratch.axes.empty())
+            log += "  " + std::to_string(variants.size()) + " variants, " + std::to_string(payloadCount) + " unique\n";
+
+        TraceScope writeScope(trace, "write", shaderName);
+        std::string variantsData = (scratch.axes.empty() ? std::string() : serializeVariants(variants, payloadIndices, payloadCount));
+        const std::string& output = buildShaderOutput(std::span<const ShaderPayload>(scratch.payloads.data(), payloadCount), variantsData, job.stage, scratch);
+        if (!writeFileBytes(job.outputPath.c_str(), output.data(), output.size())) {
+            job.log = log + "Error: could not write '" + job.outputPath + "'\n";
+            return;
+        }
+        if (writeReflectionHeaders && !writeReflectionHeader(job.outputPath, job.name, job.relPath, output)) {
+            job.log = log + "Error: could not write '" + reflectionHeaderPath(job.outputPath) + "'\n";
+            return;
+        }
+
+        job.succeeded = true;
+    } catch (std::exception& e) {
+        log += "Error: failed to compile '" + filename + "': " + e.what() + "\n";
+    }
+
+    job.log = log;
+}
+
+//Compiles the MSL of every shader that made it through compileShader() to AIR, METAL_BATCH_SIZE files per invocation
+//spread over the pool. The compiler writes <stem>.air next to each <stem>.metal when it runs in metalDir. If an
+//invocation fails, its files are compiled one by one so that only the broken shaders fail, and their outputs are removed.
+void compileMetalBatches(std::vector<ShaderJob>& jobs, ThreadPool& threadPool) {
+    struct PendingSource {
+        size_t jobIndex;
+        const std::string* name;
+    };
+    std::vector<PendingSource> pending;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (jobs[i].succeeded) {
+            for (auto& name : jobs[i].metalSources)
+                pending.push_back({i, &name});
+        }
+    }
+    if (pending.empty())
+        return;
+
+    //Small builds are spread over all workers instead of filling the first batch
+    size_t batchSize = std::clamp<size_t>((pending.size() + threadPool.threadCount() - 1) / threadPool.threadCount(), 1, METAL_BATCH_SIZE);
+    size_t batchCount = (pending.size() + batchSize - 1) / batchSize;
+    std::vector<std::string> batchLogs(batchCount);
+    std::atomic<uint32_t> invocationCount = 0;
+    auto compile = [&](size_t first, size_t last, std::string& log) {
+        std::string command = "cd \"" + metalDir + "\" && " + metalCompilerCommand + " -c";
+        for (size_t i = first; i < last; i++)
+            command += " " + *pending[i].name + ".metal";
+        invocationCount++;
+
+        return runCommand(command, log);
+    };
+
+    TraceScope metalScope(trace, "xcrun.metal.batched");
+    for (size_t batch = 0; batch < batchCount; batch++) {
+        threadPool.submit([&, batch](uint32_t) {
+            size_t first = batch * batchSize;
+            size_t last = std::min(first + batchSize, pending.size());
+            std::string batchLog;
+            if (compile(first, last, batchLog))
+                return;
+
+            for (size_t i = first; i < last; i++) {
+                ShaderJob& job = jobs[pending[i].jobIndex];
+                std::string log;
+                if (!compile(i, i + 1, log)) {
+                    job.succeeded = false;
+                    batchLogs[batch] += "Error: Metal compilation of '" + job.filename + "' failed\n" + log;
+                }
+            }
+        });
+    }
+    threadPool.wait();
+
+    //compileShader() already wrote the container and its header, which point at a function the stage library won't
+    //have. Both go away together with the manifest record, so the next build can't mistake the shader for up to date.
+    for (auto& source : pending) {
+        ShaderJob& job = jobs[source.jobIndex];
+        if (job.succeeded)
             continue;
-        uint32_t locationIndex = std::stoi(locationIndexStr);
+        std::error_code error;
+        std::filesystem::remove(job.outputPath, error);
+        std::filesystem::remove(reflectionHeaderPath(job.outputPath), error);
+        manifest.shaders.erase(job.relPath);
+    }
 
-        //std::cout << "Color attachment: " << locationIndex << std::endl;
+    for (auto& log : batchLogs)
+        std::cout << log;
+    std::cout << "Compiled " << pending.size() << " Metal sources with " << invocationCount << " compiler invocations" << std::endl;
+}
 
-        pos++;
-        size_t removePos = pos, removeSize = 0;
-        pos = source.source.find_first_not_of(", ", pos);
-        if (source.source.substr(pos, COLOR_ATTACHMENT_INDEX_NAME.size()) == COLOR_ATTACHMENT_INDEX_NAME) {
-            pos = source.source.find_first_not_of(" =", pos + COLOR_ATTACHMENT_INDEX_NAME.size());
-            removeSize = pos - removePos + 1;
-            uint32_t colorAttachmentIndex = std::stoi(source.source.substr(pos, 1));
+//See JOB_MEMORY_BASE
+uint64_t estimateJobMemory(const ShaderJob& job) {
+    FileStamp stamp;
+    getFileStamp(job.sourceDir + "/" + job.filename, stamp);
 
-            //std::cout << "Color attachment index: " << colorAttachmentIndex << std::endl;
+    return JOB_MEMORY_BASE + stamp.size * JOB_MEMORY_PER_SOURCE_BYTE;
+}
 
-            source.source.replace(removePos, removeSize, "");
-            source.mappedAttachments.push_back({colorAttachmentIndex, removePos - 1});
+//Vertex, fragment and compute shaders all go into a single job queue. Logs are flushed in job order and
+//the manifest is only touched from the main thread once everything is done, so output stays deterministic.
+//With a memory budget, a worker waits before starting a job until the estimates of the jobs in flight leave room for it,
+//and drops its scratch buffers after a job that grew them beyond its share of the budget
+void compileShaders(std::string tempDir, std::vector<ShaderJob>& jobs, ThreadPool& threadPool, std::vector<WorkerScratch>& workerScratch) {
+    std::mutex logMutex;
+    std::vector<bool> finished(jobs.size(), false);
+    size_t nextLogIndex = 0;
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        threadPool.submit([&, i](uint32_t workerIndex) {
+            uint64_t memoryEstimate = 0;
+            if (memoryBudget.limit > 0) {
+                memoryEstimate = estimateJobMemory(jobs[i]);
+                TraceScope waitScope(trace, "memory.wait", jobs[i].relPath);
+                memoryBudget.acquire(memoryEstimate);
+            }
+            WorkerScratch& scratch = workerScratch[workerIndex];
+            compileShader(jobs[i], tempDir + "/job" + std::to_string(i), scratch);
+            //MemoryBudget lets it run once nothing else does, the limit is exceeded regardless
+            if (memoryBudget.limit > 0 && memoryEstimate > memoryBudget.limit) {
+                jobs[i].log = "Warning: '" + jobs[i].relPath + "' is estimated at " + std::to_string(memoryEstimate / (1024 * 1024)) +
+                    " MB, more than --max-memory, it ran without any other job\n" + jobs[i].log;
+            }
+            if (memoryBudget.limit > 0 && scratch.retainedBytes() > memoryBudget.limit / workerScratch.size())
+                scratch = WorkerScratch();
+            memoryBudget.release(memoryEstimate);
+
+            std::lock_guard<std::mutex> lock(logMutex);
+            finished[i] = true;
+            while (nextLogIndex < jobs.size() && finished[nextLogIndex]) {
+                std::cout << jobs[nextLogIndex].log << std::flush;
+                nextLogIndex++;
+            }
+        });
+    }
+    threadPool.wait();
+
+    if (batchMetal)
+        compileMetalBatches(jobs, threadPool);
+
+    TraceScope storeScope(trace, "cache.store");
+    double parseMs = 0.0;
+    double irCopyMs = 0.0;
+    for (auto& job : jobs) {
+        parseMs += job.parseMs;
+        irCopyMs += job.irCopyMs;
+        if (job.succeeded) {
+            artifactCache.store(job.record.key, job.outputPath);
+            if (writeDepfiles)
+                writeDepfile(depfilePath(job.outputPath), job.outputPath, job.relPath, job.record);
+            manifest.shaders[job.relPath] = std::move(job.record);
         }
     }
 
-    pos = 0;
-    while (true) {
-        pos = source.source.find(INPUT_ATTACHMENT_INDEX_NAME, pos);
+    //Every target besides MSL would have parsed the module again, but gets a copy of the parsed IR instead. Both are
+    //measured, the parses that were skipped are assumed to take as long as the one that ran.
+    uint32_t extraTargets = crossCompileOptions.targetCount() - 1;
+    if (trace.enabled && extraTargets > 0 && !jobs.empty()) {
+        double savedMs = parseMs * extraTargets - irCopyMs;
+        std::cout << "Shared SPIR-V parse saved " << savedMs << " ms net (" << savedMs / jobs.size() << " ms per shader) across " << crossCompileOptions.targetCount() << " targets, after " << irCopyMs << " ms of IR copies" << std::endl;
+    }
+}
+
+//Batched Metal mode: links the AIR of every up to date shader of a stage into the stage library. A library is only relinked
+//if the set of its shaders or any of their cache keys changed, the link hash is kept next to the AIR. A failed link leaves
+//the hash alone, so the next build tries again.
+void linkMetalLibraries(const std::vector<StageDirectory>& stageDirs, const ShaderOutputs& outputs, ThreadPool& threadPool) {
+    TraceScope linkScope(trace, "xcrun.metallib.batched");
+    std::vector<std::string> stageLogs(stageDirs.size());
+    std::set<std::string> liveIntermediates;
+
+    //Every payload of a shader has its own AIR, gathered by the key prefix of their names
+    std::map<std::string, std::vector<std::string>> airFiles;
+    std::error_code error;
+    for (auto& dirEntry : std::filesystem::directory_iterator(metalDir, error)) {
+        if (dirEntry.path().extension() == ".air") {
+            std::string stem = dirEntry.path().stem().string();
+            airFiles[stem.substr(0, stem.find('_'))].push_back(dirEntry.path().string());
+        }
+    }
+    for (size_t stageIndex = 0; stageIndex < stageDirs.size(); stageIndex++) {
+        const StageDirectory& stageDir = stageDirs[stageIndex];
+        std::string libraryName = metalLibraryName(stageDir.stage);
+        std::string libraryPath = std::filesystem::path(stageDir.compiledDir).parent_path().string() + "/" + libraryName;
+        std::string linkHashPath = metalDir + "/" + libraryName + ".link";
+
+        std::string airPaths;
+        uint64_t linkHash = hashString(metallibCommand);
+        for (auto& [relPath, output] : outputs) {
+            if (output.stage != stageDir.stage)
+                continue;
+            liveIntermediates.insert(hashToHex(output.key));
+            auto record = manifest.shaders.find(output.relPath);
+            if (record == manifest.shaders.end() || record->second.key != output.key)
+                continue;
+
+            auto files = airFiles.find(hashToHex(output.key));
+            if (files == airFiles.end())
+                continue;
+            std::sort(files->second.begin(), files->second.end());
+            for (auto& airPath : files->second)
+                airPaths += " \"" + airPath + "\"";
+            linkHash = hashCombine(linkHash, output.key);
+        }
+        if (airPaths.empty())
+            continue;
 
-        if (pos == std::string::npos)
-            break;
-        
-        pos = source.source.find_first_not_of(" =", pos + INPUT_ATTACHMENT_INDEX_NAME.size());
-        std::string inputAttachmentIndexStr = source.source.substr(pos, 1);
-        if (!isNumber(inputAttachmentIndexStr))
+        std::string oldLinkHash;
+        if (readFileBytes(linkHashPath.c_str(), oldLinkHash) && oldLinkHash == hashToHex(linkHash) && std::filesystem::exists(libraryPath))
             continue;
-        uint32_t inputAttachmentIndex = std::stoi(inputAttachmentIndexStr);
 
-        //std::cout << "Input attachment: " << inputAttachmentIndex << std::endl;
+        threadPool.submit([&, stageIndex, airPaths, libraryPath, linkHashPath, linkHash](uint32_t) {
+            std::string& log = stageLogs[stageIndex];
+            if (!runCommand(metallibCommand + airPaths + " -o \"" + libraryPath + "\"", log)) {
+                log = "Error: could not link '" + libraryPath + "'\n" + log;
+                return;
+            }
 
-        pos++;
-        size_t removePos = pos, removeSize = 0;
-        pos = source.source.find_first_not_of(", ", pos);
-        if (source.source.substr(pos, COLOR_ATTACHMENT_INDEX_NAME.size()) == COLOR_ATTACHMENT_INDEX_NAME) {
-            pos = source.source.find_first_not_of(" =", pos + COLOR_ATTACHMENT_INDEX_NAME.size());
-            removeSize = pos - removePos + 1;
-            uint32_t colorAttachmentIndex = std::stoi(source.source.substr(pos, 1));
+            std::string linkHashStr = hashToHex(linkHash);
+            writeFileBytes(linkHashPath.c_str(), linkHashStr.data(), linkHashStr.size());
+            log = "Linked '" + libraryPath + "'\n";
+        });
+    }
+    threadPool.wait();
 
-            //std::cout << "Color attachment index: " << colorAttachmentIndex << std::endl;
+    for (auto& log : stageLogs)
+        std::cout << log << std::flush;
 
-            source.mappedAttachments.push_back({colorAttachmentIndex, removePos - 1});
-        } else if (source.source.substr(pos, DEPTH_ATTACHMENT_NAME.size()) == DEPTH_ATTACHMENT_NAME) {
-            //removeSize = pos - removePos + DEPTH_ATTACHMENT_NAME.size();
-            throw std::runtime_error("Depth attachment is not currently supported as an input attachment. To use it with the Vulkan backend, just make it a color attachment with random index");
-        } else {
-            throw std::runtime_error("Input attachment must have a color or depth attachment associated with it");
+    //AIR and MSL of shaders that were edited or removed since
+    for (auto& dirEntry : std::filesystem::directory_iterator(metalDir, error)) {
+        std::string extension = dirEntry.path().extension().string();
+        std::string stem = dirEntry.path().stem().string();
+        if ((extension == ".air" || extension == ".metal") && !liveIntermediates.count(stem.substr(0, stem.find('_'))))
+            std::filesystem::remove(dirEntry.path(), error);
+    }
+}
+
+//Bundles every up to date shader into a single file. Shaders that failed to compile are left out instead of
+//packing a stale output. The pack is only rewritten if the set of shaders or any of their cache keys changed.
+//Splits the shaders into the up to date ones that go into the pack and the ones that failed, returns the build hash
+//of the pack they make up
+uint64_t collectPackedShaders(const ShaderOutputs& outputs, std::vector<const ShaderOutput*>& packed, std::vector<const ShaderOutput*>& failed) {
+    uint64_t buildHash = hashCombine(lv::PACK_VERSION_MAJOR, lv::PACK_DEFAULT_PAGE_SIZE);
+    for (auto& [relPath, output] : outputs) {
+        auto record = manifest.shaders.find(output.relPath);
+        if (record == manifest.shaders.end() || record->second.key != output.key) {
+            failed.push_back(&output);
+            continue;
         }
-        source.source.replace(removePos, removeSize, "");
+
+        packed.push_back(&output);
+        buildHash = hashCombine(buildHash, (uint64_t)output.stage);
+        buildHash = hashCombine(buildHash, hashString(output.name));
+        buildHash = hashCombine(buildHash, output.key);
     }
 
-    return source;
+    return buildHash;
 }
 
-void defineGlslMacro(std::string& source, std::string macroName) {
-    size_t pos = source.find("#version");
-    pos = source.find("\n", pos);
-    source.insert(pos + 1, "#define " + macroName + "\n");
+bool packUpToDate(const std::string& packPath, uint64_t buildHash) {
+    lv::MappedFile existing;
+    lv::ShaderPackView existingPack;
+
+    return existing.open(packPath.c_str()) && existingPack.open(existing.data(), existing.size()) && existingPack.header().buildHash == buildHash;
 }
 
-void mapGlslAttachmentForMsl(PreprocessedSource& source) {
-    for (auto& mappedAttachment : source.mappedAttachments) {
-        source.source.replace(mappedAttachment.pos, 1, std::to_string(mappedAttachment.index));
-        //std::cout << "INDEX: " << mappedAttachment.index << " : " << mappedAttachment.pos << std::endl;
+void writeShaderPack(const std::string& packPath, const ShaderOutputs& outputs) {
+    TraceScope packScope(trace, "pack");
+    std::vector<const ShaderOutput*> packed, failed;
+    uint64_t buildHash = collectPackedShaders(outputs, packed, failed);
+    for (auto output : failed)
+        std::cout << "Leaving '" << output->relPath << "' out of the pack, it failed to compile" << std::endl;
+
+    //Covers exactly the shaders in the pack
+    if (writeReflectionHeaders) {
+        std::filesystem::path packDir = std::filesystem::path(packPath).parent_path();
+        std::vector<std::string> includePaths;
+        for (auto output : packed)
+            includePaths.push_back(std::filesystem::path(reflectionHeaderPath(output->outputPath)).lexically_relative(packDir.empty() ? "." : packDir).generic_string());
+        std::string headerPath = reflectionHeaderPath(packPath);
+        std::string header = generateUmbrellaHeader(includePaths);
+        std::string oldHeader;
+        if ((!readFileBytes(headerPath.c_str(), oldHeader) || oldHeader != header) && !writeFileBytes(headerPath.c_str(), header.data(), header.size()))
+            std::cout << "Error: could not write '" << headerPath << "'" << std::endl;
+    }
+
+    if (packUpToDate(packPath, buildHash)) {
+        std::cout << "Nothing to do for '" << packPath << "'" << std::endl;
+        return;
+    }
+
+    ShaderPackWriter writer;
+    writer.setBuildHash(buildHash);
+    writer.setDictionary(sectionCompressor.dictionary());
+    for (auto output : packed) {
+        lv::MappedFile file;
+        lv::ShaderContainerView container;
+        if (!file.open(output->outputPath.c_str()) || !container.open(file.data(), file.size())) {
+            std::cout << "Error: could not read compiled shader '" << output->outputPath << "'" << std::endl;
+            return;
+        }
+
+        if (!writer.addShader((lv::ContainerStage)output->stage, output->name, container)) {
+            std::cout << "Error: '" << output->relPath << "' collides with another shader in the pack" << std::endl;
+            return;
+        }
+    }
+
+    std::string pack = writer.finish();
+    if (!writeFileBytes(packPath.c_str(), pack.data(), pack.size())) {
+        std::cout << "Error: could not write '" << packPath << "'" << std::endl;
+        return;
     }
-    //std::cout << "SOURCE:\n" << source.source << std::endl;
+
+    std::cout << "Packed " << writer.shaderCount() << " shaders (" << writer.blobCount() << " unique payloads, " << pack.size() / 1024 << " KB) into '" << packPath << "'" << std::endl;
 }
 
-nh::json filesJSON;
+//Trains on the sections --compress selects (all compressible ones without it) of every compiled shader, sections that
+//are already compressed are decoded first
+bool trainSectionDictionary(const std::string& dictionaryPath, const ShaderOutputs& outputs) {
+    TraceScope trainScope(trace, "train");
+    std::vector<lv::SectionType> types = compressedSectionTypes;
+    if (types.empty())
+        types = {lv::SectionType::SpirV, lv::SectionType::Metallib, lv::SectionType::GlslSource, lv::SectionType::HlslSource};
+    lv::SectionData dictionary = {sectionCompressor.dictionary().data(), sectionCompressor.dictionary().size()};
+
+    std::vector<std::string> sections;
+    for (auto& [relPath, output] : outputs) {
+        lv::MappedFile file;
+        lv::ShaderContainerView container;
+        if (!file.open(output.outputPath.c_str()) || !container.open(file.data(), file.size()))
+            continue;
 
-std::string compilerPath = "/Users/samuliak/VulkanSDK/1.3.236.0/macOS/bin/glslc";
+        for (uint32_t i = 0; i < container.sectionCount(); i++) {
+            const lv::SectionEntry& entry = container.sectionEntry(i);
+            lv::SectionDecoder decoder;
+            if (std::find(types.begin(), types.end(), (lv::SectionType)entry.type) == types.end() ||
+                !container.sectionDecoder((lv::SectionType)entry.type, entry.index, decoder, dictionary))
+                continue;
+            std::string& data = sections.emplace_back((size_t)decoder.size(), '\0');
+            if (!decoder.readAll(data.data()))
+                sections.pop_back();
+        }
+    }
 
-std::string includeSource =
-"#extension GL_AMD_gpu_shader_half_float: enable\n"
-"#define float2 vec2\n"
-"#define float3 vec3\n"
-"#define float4 vec4\n"
-"#define float3x3 mat3\n"
-"#define float4x4 mat4\n"
-"#define half float16_t\n"
-"#define half2 f16vec2\n"
-"#define half3 f16vec3\n"
-"#define half4 f16vec4\n"
-"#define half3x3 f16mat3\n"
-"#define half4x4 f16mat4";
+    std::vector<std::string_view> samples(sections.begin(), sections.end());
+    std::string trained = trainDictionary(samples);
+    if (trained.empty()) {
+        std::cout << "Error: the compiled shaders have too little in common to train a dictionary on" << std::endl;
+        return false;
+    }
+    if (!writeFileBytes(dictionaryPath.c_str(), trained.data(), trained.size())) {
+        std::cout << "Error: could not write '" << dictionaryPath << "'" << std::endl;
+        return false;
+    }
 
-void compileShaders(std::string tempDir, std::string sourceDir, std::string compiledDir) {
-    struct stat result;
-    if (stat(sourceDir.c_str(), &result) == 0) {
-        bool compiled = false;
-        auto dirIterator = std::filesystem::directory_iterator(sourceDir);
-        for (auto& dirEntry : dirIterator) {
-            std::string path = std::filesystem::current_path().string() + "/" + dirEntry.path().string();
-
-            if (stat(path.c_str(), &result) == 0) {
-                auto modTime = result.st_mtime;
-                //std::cout << modTime << std::endl;
-                if (filesJSON[path] != modTime) {
-                    filesJSON[path] = modTime;
-                    std::string filename = dirEntry.path().filename().string();
-                    std::string filenameStem = dirEntry.path().stem().string();
-                    std::string filenameExt = dirEntry.path().extension();
-                    std::cout << "Compiling '" << filename << "'" << std::endl;
-                    std::string spirvCompiledFile1 = tempDir + "/temp1.spv";
-                    std::string spirvCompiledFile2 = tempDir + "/temp2.spv";
-                    std::string glslSourceFile1 = tempDir + "/temp1." + filenameExt;
-                    std::string glslSourceFile2 = tempDir + "/temp2." + filenameExt;
-
-                    PreprocessedSource glslSource1 = preprocessGlslShader(sourceDir + "/" + filename);
-                    PreprocessedSource glslSource2 = glslSource1;
-                    mapGlslAttachmentForMsl(glslSource2);
-                    defineGlslMacro(glslSource1.source, "LV_BACKEND_VULKAN");
-                    defineGlslMacro(glslSource2.source, "LV_BACKEND_METAL");
-                    writeFile(glslSourceFile1.c_str(), glslSource1.source.c_str());
-                    writeFile(glslSourceFile2.c_str(), glslSource2.source.c_str());
-
-                    system((compilerPath + " " + glslSourceFile1 + " -o " + spirvCompiledFile1).c_str());
-                    system((compilerPath + " " + glslSourceFile2 + " -o " + spirvCompiledFile2).c_str());
-
-                    //std::string metalSourcePath = metalSourceDir + "/" + filenameStem + ".metal";
-                    //std::string openglSourcePath = openglSourceDir + "/" + filenameStem + ".glsl";
-                    nh::json shaderJSON = compileSpirvToMSL(tempDir, spirvCompiledFile2);
-                    std::string airPath = tempDir + "/temp.air";
-                    std::string metallibPath = tempDir + "/temp.metallib";
-
-                    system(("xcrun -sdk macosx metal -gline-tables-only -frecord-sources -c " + tempDir + "/temp.metal -o " + airPath).c_str());
-                    system(("xcrun -sdk macosx metallib " + airPath + " -o " + metallibPath).c_str());
-
-                    std::string spirvFile = readFileStr(spirvCompiledFile1.c_str());
-                    std::string metallibFile = readFileStr(metallibPath.c_str());
-                    //shaderJSON[".spirv"] = spirvFile;
-                    //shaderJSON[".metallib"] = metallibFile;
-
-                    std::ofstream out(compiledDir + "/" + filenameStem + ".json");
-                    out << std::setw(4) << shaderJSON << "\nsection.spv" << spirvFile << "section.metallib" << metallibFile;
-                    out.close();
-
-                    compiled = true;
-                }
-            }
+    std::cout << "Trained a " << trained.size() / 1024 << " KB dictionary on " << samples.size() << " sections into '" << dictionaryPath << "'" << std::endl;
+
+    return true;
+}
+
+//Everything besides the shader sources that affects the output goes into the cache key
+uint64_t computeSettingsHash() {
+    std::string settings = "macros=" + std::string(VULKAN_BACKEND_MACRO) + "," + std::string(METAL_BACKEND_MACRO);
+    settings += ";frontend=" + frontend->fingerprint();
+    settings += ";metal=" + metalCompilerCommand;
+    settings += ";metallib=" + metallibCommand;
+    settings += ";targets=" + crossCompileOptions.fingerprint();
+    settings += ";metalBatch=" + std::to_string(batchMetal);
+    settings += ";compress=";
+    for (lv::SectionType type : compressedSectionTypes)
+        settings += std::string(lv::sectionTypeName((uint32_t)type)) + ",";
+    settings += hashToHex(sectionCompressor.dictionaryHash());
+
+    return hashString(settings);
+}
+
+void saveManifest(const std::string& manifestPath) {
+    TraceScope saveScope(trace, "manifest.save");
+    manifest.save(manifestPath);
+}
+
+//Prints the timings of the build that just finished and writes its trace, then starts over for the next build
+void reportTrace(const std::string& tracePath) {
+    if (!trace.enabled)
+        return;
+
+    if (!tracePath.empty() && !trace.writeChromeTrace(tracePath))
+        std::cout << "Error: could not write '" << tracePath << "'" << std::endl;
+    trace.printSummary(std::cout, SLOWEST_SHADER_COUNT);
+    trace.clear();
+}
+
+//lava_common.glsl is only written if it changed, so its mtime stays put and nothing that includes it has to be rehashed.
+//It goes through a temporary file and a rename, so that parallel per file invocations never see it half written.
+void writeIncludeSource(const std::string& tempDir) {
+    std::string includeSourcePath = tempDir + "/lava_common.glsl";
+    std::string oldIncludeSource;
+    if (readFileBytes(includeSourcePath.c_str(), oldIncludeSource) && oldIncludeSource == includeSource)
+        return;
+
+    std::string partialPath = includeSourcePath + "." + std::to_string(getpid());
+    std::error_code error;
+    if (writeFileBytes(partialPath.c_str(), includeSource.data(), includeSource.size()))
+        std::filesystem::rename(partialPath, includeSourcePath, error);
+}
+
+//--check: the same stats and hashes as a build, but nothing is compiled, restored or written. Returns false if any
+//output is out of date.
+bool checkShaders(const std::string& tempDir, SourceScanner& scanner, const std::string& packPath) {
+    size_t staleCount = 0;
+    std::string oldIncludeSource;
+    if (!readFileBytes((tempDir + "/lava_common.glsl").c_str(), oldIncludeSource) || oldIncludeSource != includeSource) {
+        std::cout << "Stale: '" << tempDir << "/lava_common.glsl'" << std::endl;
+        staleCount++;
+    }
+
+    ShaderOutputs outputs;
+    std::vector<ShaderSource> sources;
+    listShaderSources(scanner, sources);
+    for (auto& source : sources) {
+        ShaderRecord record;
+        if (checkShader(source, outputs, record) == ShaderState::Stale) {
+            std::cout << "Stale: '" << manifest.absolutePath(source.relPath) << "'" << std::endl;
+            staleCount++;
         }
-        if (!compiled) {
-            std::cout << "Nothing to do for '" << sourceDir << "'" << std::endl;
+    }
+
+    //Only meaningful if every shader is up to date, otherwise the pack is stale anyway
+    if (!packPath.empty() && staleCount == 0) {
+        std::vector<const ShaderOutput*> packed, failed;
+        if (!packUpToDate(packPath, collectPackedShaders(outputs, packed, failed))) {
+            std::cout << "Stale: '" << packPath << "'" << std::endl;
+            staleCount++;
         }
+    }
+
+    if (staleCount == 0)
+        std::cout << "Up to date (" << outputs.size() << " shaders)" << std::endl;
+
+    return staleCount == 0;
+}
+
+//Per file mode, meant to be driven by Ninja or Make: compiles one source into one container, without a manifest, so
+//that the build system decides what is stale and schedules the shaders next to everything else. The temporary
+//directory with lava_common.glsl lives next to the output. Returns false if the shader failed to compile.
+bool compileSingleShader(const std::string& tempDir, const std::string& sourcePath, const std::string& outputPath, const std::string& depfile) {
+    std::optional<ShaderStage> stage = shaderStageFromPath(sourcePath);
+    if (!stage) {
+        std::cout << "Error: cannot tell the stage of '" << sourcePath << "' from its extension or directory" << std::endl;
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(tempDir, error);
+    writeIncludeSource(tempDir);
+    std::filesystem::path output(outputPath);
+    std::string outputDir = std::filesystem::path(tempDir).parent_path().string();
+
+    //Same include setup as the directory mode, only rooted at the output directory
+    manifest.rootDir = outputDir;
+    manifest.includeDirs = {".temp"};
+    ShaderJob job;
+    job.stage = *stage;
+    job.sourceDir = std::filesystem::path(sourcePath).parent_path().string();
+    if (job.sourceDir.empty())
+        job.sourceDir = ".";
+    job.filename = std::filesystem::path(sourcePath).filename().string();
+    job.name = output.stem().string();
+    job.relPath = manifest.relativePath(sourcePath);
+    job.outputPath = outputPath;
+    if (!manifest.computeShaderKey(job.relPath, (uint32_t)job.stage, settingsHash, job.record)) {
+        std::cout << "Error: could not open file '" << sourcePath << "'" << std::endl;
+        return false;
+    }
+
+    //Named after the output, so parallel invocations for different shaders never share a scratch directory
+    if (artifactCache.restore(job.record.key, outputPath)) {
+        std::cout << "Restored '" << job.filename << "' from cache" << std::endl;
+        job.succeeded = (!writeReflectionHeaders || writeReflectionHeader(outputPath, job.name, job.relPath));
     } else {
-        std::cout << "No such file or directory '" << sourceDir << "'" << std::endl;
+        WorkerScratch scratch;
+        compileShader(job, tempDir + "/" + output.filename().string() + ".job", scratch);
+        std::cout << job.log << std::flush;
+        if (job.succeeded)
+            artifactCache.store(job.record.key, outputPath);
+    }
+    artifactCache.finishBuild();
+    if (job.succeeded && !depfile.empty() && !writeDepfile(depfile, outputPath, job.relPath, job.record)) {
+        std::cout << "Error: could not write '" << depfile << "'" << std::endl;
+        return false;
     }
+
+    return job.succeeded;
+}
+
+//Per build hit rate, then the totals of the directory are updated and the cache is trimmed if it grew too large
+void reportArtifactCache() {
+    const ArtifactCacheStats& stats = artifactCache.stats;
+    if (stats.hits > 0)
+        std::cout << "Cache: " << stats.hits << " hits, " << stats.misses << " misses" << std::endl;
+    if (!artifactCache.finishBuild())
+        std::cout << "Warning: could not update the statistics of the cache '" << artifactCache.dir << "'" << std::endl;
+}
+
+//--cache-stats: totals of every build that used the directory, on any machine
+void printArtifactCacheStats() {
+    ArtifactCacheStats totals;
+    if (!artifactCache.loadStats(totals)) {
+        std::cout << "No statistics in the cache '" << artifactCache.dir << "'" << std::endl;
+        return;
+    }
+
+    uint64_t lookups = totals.hits + totals.misses;
+    char line[256];
+    std::cout << "Cache '" << artifactCache.dir << "'\n";
+    snprintf(line, sizeof(line), "  hits       %12llu (%.1f%%)\n", (unsigned long long)totals.hits, lookups > 0 ? 100.0 * totals.hits / lookups : 0.0);
+    std::cout << line;
+    snprintf(line, sizeof(line), "  misses     %12llu\n  stores     %12llu\n  evictions  %12llu\n", (unsigned long long)totals.misses, (unsigned long long)totals.stores, (unsigned long long)totals.evictions);
+    std::cout << line;
+    snprintf(line, sizeof(line), "  size       %12.1f MB of %llu MB\n", totals.size / (1024.0 * 1024.0), (unsigned long long)(artifactCache.maxSize / (1024 * 1024)));
+    std::cout << line << std::flush;
+}
+
+void printUsage() {
+    std::cout << "Usage: shader_compiler [-j N] [--frontend glslang|glslc|fake] [--glslc path] [--metal command] [--metallib command] [--batch-metal] [--glsl-version N] [--hlsl-shader-model N] [--pack file] [--depfiles] [--cpp-headers] [--compress spirv,metallib,glsl,hlsl|all] [--dictionary file] [--train-dictionary file] [--cache-dir path] [--cache-max-size MB] [--max-memory MB] [--check | --watch] [--trace file] [--timings] <shader directory>\n"
+                 "       shader_compiler [options] --compile <source> -o <output> [--depfile file]\n"
+                 "       shader_compiler [--cache-dir path] --cache-stats [<shader directory>]" << std::endl;
 }
 
 int main(int argc, char* argv[]) {
     //std::cout << argc << std::endl;
-    if (argc == 1) {
+    uint32_t threadCount = 1;
+    std::string frontendName = defaultGlslFrontendName();
+    std::string directory;
+    std::string packPath;
+    bool watch = false;
+    bool checkOnly = false;
+    std::string compileSourcePath;
+    std::string compileOutputPath;
+    std::string compileDepfilePath;
+    std::string tracePath;
+    bool cacheStatsOnly = false;
+    std::string dictionaryPath;
+    std::string trainDictionaryPath;
+    uint64_t cacheMaxSizeMB = DEFAULT_CACHE_MAX_SIZE_MB;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg.rfind("-j", 0) == 0) {
+            std::string countStr = (arg == "-j" ? (i + 1 < argc ? argv[++i] : "") : arg.substr(2));
+            if (!parseNumberArgument(countStr, threadCount)) {
+                std::cout << "Option '-j' expects a thread count" << std::endl;
+                printUsage();
+                return 1;
+            }
+            if (threadCount == 0)
+                threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+        } else if ((arg == "--frontend" || arg == "--glslc") && i + 1 < argc) {
+            (arg == "--frontend" ? frontendName : compilerPath) = argv[++i];
+        } else if ((arg == "--metal" || arg == "--metallib") && i + 1 < argc) {
+            //Lets the Metal toolchain be replaced, e.g. by a stub on machines without Xcode
+            (arg == "--metal" ? metalCompilerCommand : metallibCommand) = argv[++i];
+        } else if (arg == "--batch-metal") {
+            batchMetal = true;
+        } else if ((arg == "--glsl-version" || arg == "--hlsl-shader-model") && i + 1 < argc) {
+            //Each of these turns on its target next to MSL
+            bool glsl = (arg == "--glsl-version");
+            if (!parseNumberArgument(argv[++i], glsl ? crossCompileOptions.glsl.version : crossCompileOptions.hlsl.shaderModel)) {
+                std::cout << "Option '" << arg << "' expects a number" << std::endl;
+                printUsage();
+                return 1;
+            }
+            (glsl ? crossCompileOptions.glsl.enabled : crossCompileOptions.hlsl.enabled) = true;
+        } else if (arg == "--pack" && i + 1 < argc) {
+            packPath = argv[++i];
+        } else if (arg == "--depfiles") {
+            writeDepfiles = true;
+        } else if (arg == "--cpp-headers") {
+            writeReflectionHeaders = true;
+        } else if (arg == "--compress" && i + 1 < argc) {
+            std::string typesStr = argv[++i];
+            compressedSectionTypes.clear();
+            for (size_t start = 0; start <= typesStr.size();) {
+                size_t end = std::min(typesStr.find(',', start), typesStr.size());
+                std::string typeName = typesStr.substr(start, end - start);
+                start = end + 1;
+                size_t count = compressedSectionTypes.size();
+                for (lv::SectionType type : {lv::SectionType::SpirV, lv::SectionType::Metallib, lv::SectionType::GlslSource, lv::SectionType::HlslSource}) {
+                    if (typeName == "all" || typeName == lv::sectionTypeName((uint32_t)type))
+                        compressedSectionTypes.push_back(type);
+                }
+                if (compressedSectionTypes.size() == count) {
+                    std::cout << "Option '--compress' expects a comma separated list of spirv, metallib, glsl and hlsl, or all" << std::endl;
+                    printUsage();
+                    return 1;
+                }
+            }
+            //Sorted and unique, so the same selection always gives the same settings hash
+            std::sort(compressedSectionTypes.begin(), compressedSectionTypes.end());
+            compressedSectionTypes.erase(std::unique(compressedSectionTypes.begin(), compressedSectionTypes.end()), compressedSectionTypes.end());
+        } else if ((arg == "--dictionary" || arg == "--train-dictionary") && i + 1 < argc) {
+            (arg == "--dictionary" ? dictionaryPath : trainDictionaryPath) = argv[++i];
+        } else if (arg == "--cache-dir" && i + 1 < argc) {
+            artifactCache.dir = argv[++i];
+        } else if ((arg == "--cache-max-size" || arg == "--max-memory") && i + 1 < argc) {
+            uint64_t sizeMB;
+            if (!parseNumberArgument<uint64_t>(argv[++i], sizeMB, std::numeric_limits<uint64_t>::max() / (1024 * 1024))) {
+                std::cout << "Option '" << arg << "' expects a size in MB" << std::endl;
+                printUsage();
+                return 1;
+            }
+            if (arg == "--cache-max-size")
+                cacheMaxSizeMB = sizeMB;
+            else
+                memoryBudget.limit = sizeMB * 1024 * 1024;
+        } else if (arg == "--cache-stats") {
+            cacheStatsOnly = true;
+        } else if (arg == "--check") {
+            checkOnly = true;
+        } else if (arg == "--compile" && i + 1 < argc) {
+            compileSourcePath = argv[++i];
+        } else if (arg == "-o" && i + 1 < argc) {
+            compileOutputPath = argv[++i];
+        } else if (arg == "--depfile" && i + 1 < argc) {
+            compileDepfilePath = argv[++i];
+        } else if (arg == "--watch") {
+            watch = true;
+        } else if (arg == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+            trace.enabled = true;
+        } else if (arg == "--timings") {
+            trace.enabled = true;
+        } else if (directory.empty()) {
+            directory = arg;
+        } else {
+            std::cout << "You must enter exactly 1 shader directory" << std::endl;
+            printUsage();
+            return 0;
+        }
+    }
+
+    //A shared directory is meant to be set once per machine or CI runner, not on every command line
+    const char* cacheDirEnv = getenv("LV_SHADER_CACHE_DIR");
+    if (artifactCache.dir.empty() && cacheDirEnv && *cacheDirEnv)
+        artifactCache.dir = cacheDirEnv;
+    artifactCache.maxSize = cacheMaxSizeMB * 1024 * 1024;
+    if (cacheStatsOnly) {
+        if (artifactCache.dir.empty() && directory.empty()) {
+            std::cout << "Option '--cache-stats' expects '--cache-dir', LV_SHADER_CACHE_DIR or a shader directory" << std::endl;
+            return 1;
+        }
+        if (artifactCache.dir.empty())
+            artifactCache.dir = directory + "/.temp/cache";
+        printArtifactCacheStats();
+        return 0;
+    }
+
+    //Per file mode has no manifest, so everything that works across shaders is left out
+    bool compileOnly = !compileSourcePath.empty();
+    if (compileOnly && (compileOutputPath.empty() || !directory.empty() || watch || checkOnly || batchMetal || !packPath.empty())) {
+        std::cout << "Option '--compile' expects '-o <output>' and can't be combined with a shader directory, '--watch', '--check', '--batch-metal' or '--pack'" << std::endl;
+        printUsage();
+        return 1;
+    }
+    if (checkOnly && watch) {
+        std::cout << "Options '--check' and '--watch' can't be combined" << std::endl;
+        return 1;
+    }
+    if (!trainDictionaryPath.empty() && (compileOnly || checkOnly || watch)) {
+        std::cout << "Option '--train-dictionary' can't be combined with '--compile', '--check' or '--watch'" << std::endl;
+        return 1;
+    }
+
+    //Part of the settings hash, so it has to be known before any key is computed
+    if (!dictionaryPath.empty()) {
+        std::string dictionary;
+        if (compressedSectionTypes.empty()) {
+            std::cout << "Option '--dictionary' expects '--compress'" << std::endl;
+            return 1;
+        }
+        if (!readFileBytes(dictionaryPath.c_str(), dictionary) || dictionary.empty() || dictionary.size() > lv::MAX_DICTIONARY_SIZE) {
+            std::cout << "Error: '" << dictionaryPath << "' is not a dictionary of at most " << lv::MAX_DICTIONARY_SIZE << " bytes" << std::endl;
+            return 1;
+        }
+        sectionCompressor = SectionCompressor(dictionary);
+    }
+
+    if (!compileOnly && directory.empty()) {
         std::cout << "You must enter a valid shader directory" << std::endl;
+        printUsage();
         return 0;
-    } else if (argc > 2) {
-        std::cout << "You must enter exactly 1 argument" << std::endl;
+    }
+
+    std::string tempDir;
+    if (compileOnly) {
+        std::filesystem::path outputDir = std::filesystem::path(compileOutputPath).parent_path();
+        tempDir = (outputDir.empty() ? std::string(".") : outputDir.string()) + "/.temp";
+    } else {
+        tempDir = directory + "/.temp";
+        if (!checkOnly)
+            mkdir(tempDir.c_str(), 0700);
+    }
+
+    //The sources used to live directly in the temp directory, so keep it on the include path for lava_common.glsl
+    FrontendOptions frontendOptions;
+    frontendOptions.compilerPath = compilerPath;
+    frontendOptions.includeDirs = {tempDir};
+    frontend = createGlslFrontend(frontendName, frontendOptions);
+    if (!frontend) {
+        std::cout << "Unknown or unavailable frontend '" << frontendName << "'" << std::endl;
         return 0;
     }
-    
-    std::string directory(argv[1]);
-    std::string filesPath = std::string(argv[0]);
-    filesPath = filesPath.substr(0, filesPath.find_last_of("/")) + "/files.json";
 
-    std::string text = readFileStr(filesPath.c_str());
-    filesJSON = nh::json::parse(text);
+    if (artifactCache.dir.empty())
+        artifactCache.dir = tempDir + "/cache";
+
+    if (compileOnly) {
+        settingsHash = computeSettingsHash();
+        bool succeeded = compileSingleShader(tempDir, compileSourcePath, compileOutputPath, compileDepfilePath);
+        reportTrace(tracePath);
+
+        return succeeded ? 0 : 1;
+    }
+
+    std::string manifestPath = tempDir + "/build_manifest";
+    manifest.rootDir = directory;
+    manifest.includeDirs = {".temp"};
+    manifest.load(manifestPath);
+    metalDir = tempDir + "/metal";
+    settingsHash = computeSettingsHash();
+    std::vector<StageDirectory> stageDirs = stageDirectories(directory);
+    //--check reads the snapshot but never writes it, like everything else in the temp directory
+    std::string snapshotPath = tempDir + "/source_snapshot";
+    SourceScanner scanner;
+    scanner.rootDir = directory;
+    scanner.load(snapshotPath);
+    if (checkOnly)
+        return checkShaders(tempDir, scanner, packPath) ? 0 : 1;
+
+    if (batchMetal)
+        std::filesystem::create_directories(metalDir);
+    writeIncludeSource(tempDir);
+
+    std::vector<ShaderJob> jobs;
+    ShaderOutputs outputs;
+    {
+        TraceScope collectScope(trace, "collect");
+        collectShaderJobs(scanner, jobs, outputs);
+    }
+    scanner.save(snapshotPath);
+
+    //The pool and the worker buffers are kept alive for the whole watch session
+    ThreadPool threadPool(watch ? threadCount : std::min<uint32_t>(threadCount, std::max<size_t>(jobs.size(), 1)));
+    std::vector<WorkerScratch> workerScratch(threadPool.threadCount());
+    compileShaders(tempDir, jobs, threadPool, workerScratch);
+
+    if (batchMetal)
+        linkMetalLibraries(stageDirs, outputs, threadPool);
+    if (!packPath.empty())
+        writeShaderPack(packPath, outputs);
+
+    saveManifest(manifestPath);
+    reportArtifactCache();
+    bool trained = (trainDictionaryPath.empty() || trainSectionDictionary(trainDictionaryPath, outputs));
+    reportTrace(tracePath);
 
-    std::string tempDir = directory + "/.temp";
-    mkdir(tempDir.c_str(), 0700);
+    if (!watch)
+        return trained ? 0 : 1;
 
-    std::ofstream includeSourceOut(tempDir + "/lava_common.glsl");
-    includeSourceOut << includeSource;
-    includeSourceOut.close();
+    FileWatcher watcher;
+    if (!watcher.open() || !watcher.addDirectory(directory, {COMPILED_DIR})) {
+        std::cout << "Error: could not watch '" << directory << "'" << std::endl;
+        return 0;
+    }
+    std::cout << "Watching '" << directory << "' for changes" << std::endl;
+
+    std::vector<std::string> changedPaths;
+    std::chrono::steady_clock::time_point firstEvent;
+    bool overflowed;
+    while (watcher.waitForChanges(std::chrono::milliseconds(WATCH_DEBOUNCE_MS), changedPaths, firstEvent, overflowed)) {
+        jobs.clear();
+        bool changed;
+        {
+            TraceScope collectScope(trace, "collect");
+            //Some changes were lost, so every shader on disk and every one built before counts as changed
+            if (overflowed) {
+                std::cout << "Too many changes at once, rescanning '" << directory << "'" << std::endl;
+                std::vector<ShaderSource> sources;
+                listShaderSources(scanner, sources);
+                scanner.save(snapshotPath);
+                for (auto& source : sources)
+                    changedPaths.push_back(manifest.absolutePath(source.relPath));
+                for (auto& [relPath, output] : outputs)
+                    changedPaths.push_back(manifest.absolutePath(relPath));
+            }
+            changed = collectChangedShaderJobs(changedPaths, jobs, outputs);
+        }
+        if (!changed) {
+            trace.clear();
+            continue;
+        }
+
+        compileShaders(tempDir, jobs, threadPool, workerScratch);
 
-    compileShaders(tempDir, directory + "/source/vertex", directory + "/compiled/vertex");
-    compileShaders(tempDir, directory + "/source/fragment", directory + "/compiled/fragment");
-    compileShaders(tempDir, directory + "/source/compute", directory + "/compiled/compute");
+        if (batchMetal)
+            linkMetalLibraries(stageDirs, outputs, threadPool);
+        if (!packPath.empty())
+            writeShaderPack(packPath, outputs);
 
-    std::ofstream out(filesPath);
-    out << std::setw(4) << filesJSON << std::endl;
-    out.close();
+        saveManifest(manifestPath);
+        reportArtifactCache();
+
+        size_t failedCount = std::count_if(jobs.begin(), jobs.end(), [](const ShaderJob& job) { return !job.succeeded; });
+        double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - firstEvent).count();
+        std::cout << "Rebuilt in " << (int64_t)latency << " ms from edit to artifact (" << jobs.size() << " compiled, " << failedCount << " failed)" << std::endl;
+        reportTrace(tracePath);
+    }
 
     return 0;
 }
@@ -0,0 +1,598 @@
+#ifndef LV_SHADER_CONTAINER_H
+#define LV_SHADER_CONTAINER_H
+
+//Header-only reader for the compiled shader container (.lvsc). The container is meant to be mmapped: every
+//accessor hands out pointers into the mapped memory, nothing is parsed or copied.
+//
+//Layout (little endian):
+//  ContainerHeader
+//  SectionEntry[sectionCount]     at header.sectionTableOffset
+//  payloads                       each at its own alignment, SPIR-V and metallib at 16 bytes
+//
+//The reflection section is a ReflectionHeader followed by BindingRecord[bindingCount], sorted by set and binding,
+//then DescriptorSetRecord[setCount] and the binding slots. Every set from 0 to setCount - 1 has a dense slot for every
+//binding from 0 to its highest binding, holding the index of the BindingRecord or INVALID_BINDING. That makes
+//ReflectionView::find() O(1), so descriptor and argument tables can be filled in without searching.
+//
+//Containers built in batched Metal mode have no metallib section. Their function lives in a library shared by the
+//whole stage instead, the metal function section is a MetalFunctionHeader followed by the library filename (relative
+//to the compiled directory) and the function name, neither of them null terminated.
+//
+//A shader with permutations has a variants section: a VariantsHeader followed by VariantRecord[variantCount], sorted
+//by key, and the variant names. Variants that compiled to the same SPIR-V share a payload, every payload has its own
+//reflection, SPIR-V, metallib (or metal function) and source sections, with the payload index as the section index.
+//Containers without a variants section have a single payload 0.
+//
+//Vertex shaders with inputs have a vertex inputs section per payload, VertexInputRecord[] sorted by location.
+//
+//The SPIR-V, metallib and source sections may be compressed, see section_compression.hpp. The accessors for those
+//return nothing for a compressed section, sectionDecoder() reads any of them.
+//
+//Versions: a minor bump only adds what older readers of the same major can skip, e.g. a new section type or a field
+//in the trailing padding of a record. Anything that changes the meaning of bytes an older reader already reads bumps
+//the major, readers reject any other major. 2.0 added the compressed sections, a 1.x reader would have handed out the
+//compressed bytes as SPIR-V. Readers also reject section flags they don't know.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "hash.hpp"
+#include "section_compression.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace lv {
+
+const uint32_t CONTAINER_MAGIC = 0x4353564c; //"LVSC"
+const uint16_t CONTAINER_VERSION_MAJOR = 2;
+const uint16_t CONTAINER_VERSION_MINOR = 0;
+const uint32_t CONTAINER_PAYLOAD_ALIGNMENT = 16;
+
+const uint32_t INVALID_BINDING = 0xffffffff;
+
+enum class SectionType : uint32_t {
+    Reflection = 1,
+    SpirV = 2,
+    Metallib = 3,
+    //Optional cross compiled sources, only present if the target was enabled
+    GlslSource = 4,
+    HlslSource = 5,
+    //Replaces the metallib section in batched Metal mode
+    MetalFunction = 6,
+    Variants = 7,
+    VertexInputs = 8
+};
+
+enum class ContainerStage : uint32_t {
+    Vertex = 0,
+    Fragment = 1,
+    Compute = 2
+};
+
+enum class DescriptorType : uint32_t {
+    Buffer = 0,
+    CombinedImageSampler = 1,
+    Image = 2
+};
+
+struct ContainerHeader {
+    uint32_t magic;
+    uint16_t versionMajor;
+    uint16_t versionMinor;
+    uint32_t headerSize;
+    uint32_t sectionCount;
+    uint64_t sectionTableOffset;
+    uint64_t fileSize;
+};
+static_assert(sizeof(ContainerHeader) == 32, "ContainerHeader must be 32 bytes");
+
+struct SectionEntry {
+    uint32_t type;
+    //Distinguishes several sections of the same type
+    uint32_t index;
+    uint64_t offset;
+    uint64_t size;
+    //XXH64 of the payload
+    uint64_t hash;
+    uint32_t alignment;
+    //SECTION_FLAG_COMPRESSED
+    uint32_t flags;
+};
+static_assert(sizeof(SectionEntry) == 40, "SectionEntry must be 40 bytes");
+
+struct ReflectionHeader {
+    uint32_t stage;
+    //Metal buffer index of the push constants, INVALID_BINDING if there are none
+    uint32_t pushConstantBufferBinding;
+    uint32_t bindingCount;
+    //0 for shaders without any bindings
+    uint32_t setCount;
+};
+static_assert(sizeof(ReflectionHeader) == 16, "ReflectionHeader must be 16 bytes");
+
+//Unused Metal indices are INVALID_BINDING
+struct BindingRecord {
+    uint32_t set;
+    uint32_t binding;
+    uint32_t descriptorType;
+    uint32_t bufferBinding;
+    uint32_t textureBinding;
+    uint32_t samplerBinding;
+};
+static_assert(sizeof(BindingRecord) == 24, "BindingRecord must be 24 bytes");
+
+struct DescriptorSetRecord {
+    uint32_t firstSlot;
+    //Highest binding of the set + 1, 0 for sets without any bindings
+    uint32_t slotCount;
+};
+static_assert(sizeof(DescriptorSetRecord) == 8, "DescriptorSetRecord must be 8 bytes");
+
+enum class VertexInputType : uint32_t {
+    Float = 0,
+    Half = 1,
+    Int = 2,
+    UInt = 3
+};
+
+//The location doubles as the Metal attribute index
+struct VertexInputRecord {
+    uint32_t location;
+    uint32_t baseType;
+    uint32_t componentCount;
+};
+static_assert(sizeof(VertexInputRecord) == 12, "VertexInputRecord must be 12 bytes");
+
+struct MetalFunctionHeader {
+    uint32_t libraryNameSize;
+    uint32_t functionNameSize;
+};
+static_assert(sizeof(MetalFunctionHeader) == 8, "MetalFunctionHeader must be 8 bytes");
+
+struct VariantsHeader {
+    uint32_t variantCount;
+    uint32_t payloadCount;
+};
+static_assert(sizeof(VariantsHeader) == 8, "VariantsHeader must be 8 bytes");
+
+struct VariantRecord {
+    //variantKeyHash() of the name
+    uint64_t key;
+    uint32_t payloadIndex;
+    //Into the names following the records
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t reserved;
+};
+static_assert(sizeof(VariantRecord) == 24, "VariantRecord must be 24 bytes");
+
+//FNV-1a of the canonical variant name, e.g. "MSAA_SAMPLES=4;SHADOWS": the axes sorted by name, toggles that are off
+//left out
+inline uint64_t variantKeyHash(std::string_view name) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (char c : name) {
+        hash ^= (uint8_t)c;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+struct SectionData {
+    const void* data = nullptr;
+    size_t size = 0;
+
+    explicit operator bool() const {
+        return data != nullptr;
+    }
+};
+
+struct ReflectionView {
+    const ReflectionHeader* header = nullptr;
+    const BindingRecord* bindings = nullptr;
+    const DescriptorSetRecord* sets = nullptr;
+    const uint32_t* slots = nullptr;
+
+    explicit operator bool() const {
+        return header != nullptr;
+    }
+
+    uint32_t bindingCount() const {
+        return header ? header->bindingCount : 0;
+    }
+
+    uint32_t setCount() const {
+        return header ? header->setCount : 0;
+    }
+
+    //Number of binding slots of the set, i.e. its highest binding + 1
+    uint32_t setBindingCount(uint32_t set) const {
+        return set < setCount() ? sets[set].slotCount : 0;
+    }
+
+    //O(1), nullptr if the shader doesn't use the binding
+    const BindingRecord* find(uint32_t set, uint32_t binding) const {
+        if (set >= setCount() || binding >= sets[set].slotCount)
+            return nullptr;
+
+        uint32_t index = slots[sets[set].firstSlot + binding];
+
+        return index < header->bindingCount ? &bindings[index] : nullptr;
+    }
+};
+
+struct VariantsView {
+    const VariantsHeader* header = nullptr;
+    const VariantRecord* records = nullptr;
+    const char* names = nullptr;
+
+    explicit operator bool() const {
+        return header != nullptr;
+    }
+
+    uint32_t variantCount() const {
+        return header ? header->variantCount : 0;
+    }
+
+    uint32_t payloadCount() const {
+        return header ? header->payloadCount : 1;
+    }
+
+    std::string_view name(const VariantRecord& record) const {
+        return std::string_view(names + record.nameOffset, record.nameLength);
+    }
+
+    //Binary search over the keys, nullptr if the shader has no such variant
+    const VariantRecord* find(uint64_t key) const {
+        uint32_t first = 0, last = variantCount();
+        while (first < last) {
+            uint32_t middle = first + (last - first) / 2;
+            if (records[middle].key < key)
+                first = middle + 1;
+            else
+                last = middle;
+        }
+
+        return (first < variantCount() && records[first].key == key ? &records[first] : nullptr);
+    }
+
+    const VariantRecord* find(std::string_view name) const {
+        const VariantRecord* record = find(variantKeyHash(name));
+
+        return (record && this->name(*record) == name ? record : nullptr);
+    }
+};
+
+struct VertexInputsView {
+    const VertexInputRecord* records = nullptr;
+    uint32_t count = 0;
+
+    explicit operator bool() const {
+        return records != nullptr;
+    }
+};
+
+//Where to find the shader's function, e.g. newLibraryWithURL(library) followed by newFunctionWithName(function)
+struct MetalFunctionView {
+    std::string_view library;
+    std::string_view function;
+
+    explicit operator bool() const {
+        return !function.empty();
+    }
+};
+
+//The sections the compiler may compress, everything else is always read in place
+inline bool isCompressibleSection(SectionType type) {
+    return type == SectionType::SpirV || type == SectionType::Metallib || type == SectionType::GlslSource || type == SectionType::HlslSource;
+}
+
+inline const char* sectionTypeName(uint32_t type) {
+    switch ((SectionType)type) {
+    case SectionType::Reflection:
+        return "reflection";
+    case SectionType::SpirV:
+        return "spirv";
+    case SectionType::Metallib:
+        return "metallib";
+    case SectionType::GlslSource:
+        return "glsl";
+    case SectionType::HlslSource:
+        return "hlsl";
+    case SectionType::MetalFunction:
+        return "metalFunction";
+    case SectionType::Variants:
+        return "variants";
+    case SectionType::VertexInputs:
+        return "vertexInputs";
+    }
+
+    return "unknown";
+}
+
+//Bounds checked view of a reflection section
+inline ReflectionView parseReflection(SectionData data) {
+    if (data.size < sizeof(ReflectionHeader))
+        return {};
+
+    const ReflectionHeader* reflectionHeader = static_cast<const ReflectionHeader*>(data.data);
+    size_t remaining = data.size - sizeof(ReflectionHeader);
+    if (remaining / sizeof(BindingRecord) < reflectionHeader->bindingCount)
+        return {};
+    remaining -= reflectionHeader->bindingCount * sizeof(BindingRecord);
+    if (remaining / sizeof(DescriptorSetRecord) < reflectionHeader->setCount)
+        return {};
+    remaining -= reflectionHeader->setCount * sizeof(DescriptorSetRecord);
+
+    const BindingRecord* bindings = reinterpret_cast<const BindingRecord*>(reflectionHeader + 1);
+    const DescriptorSetRecord* sets = reinterpret_cast<const DescriptorSetRecord*>(bindings + reflectionHeader->bindingCount);
+    size_t slotCount = remaining / sizeof(uint32_t);
+    for (uint32_t i = 0; i < reflectionHeader->setCount; i++) {
+        if (sets[i].firstSlot > slotCount || sets[i].slotCount > slotCount - sets[i].firstSlot)
+            return {};
+    }
+
+    return {reflectionHeader, bindings, sets, reinterpret_cast<const uint32_t*>(sets + reflectionHeader->setCount)};
+}
+
+//Bounds checked view of a metal function section
+inline MetalFunctionView parseMetalFunction(SectionData data) {
+    if (data.size < sizeof(MetalFunctionHeader))
+        return {};
+
+    const MetalFunctionHeader* functionHeader = static_cast<const MetalFunctionHeader*>(data.data);
+    size_t remaining = data.size - sizeof(MetalFunctionHeader);
+    if (functionHeader->libraryNameSize > remaining || functionHeader->functionNameSize > remaining - functionHeader->libraryNameSize)
+        return {};
+
+    const char* names = reinterpret_cast<const char*>(functionHeader + 1);
+
+    return {std::string_view(names, functionHeader->libraryNameSize), std::string_view(names + functionHeader->libraryNameSize, functionHeader->functionNameSize)};
+}
+
+//Bounds checked view of a vertex inputs section
+inline VertexInputsView parseVertexInputs(SectionData data) {
+    if (!data || data.size % sizeof(VertexInputRecord) != 0)
+        return {};
+
+    return {static_cast<const VertexInputRecord*>(data.data), (uint32_t)(data.size / sizeof(VertexInputRecord))};
+}
+
+//Bounds checked view of a variants section
+inline VariantsView parseVariants(SectionData data) {
+    if (data.size < sizeof(VariantsHeader))
+        return {};
+
+    const VariantsHeader* variantsHeader = static_cast<const VariantsHeader*>(data.data);
+    size_t remaining = data.size - sizeof(VariantsHeader);
+    if (remaining / sizeof(VariantRecord) < variantsHeader->variantCount)
+        return {};
+    remaining -= variantsHeader->variantCount * sizeof(VariantRecord);
+
+    const VariantRecord* records = reinterpret_cast<const VariantRecord*>(variantsHeader + 1);
+    for (uint32_t i = 0; i < variantsHeader->variantCount; i++) {
+        if (records[i].payloadIndex >= variantsHeader->payloadCount || records[i].nameOffset > remaining ||
+            records[i].nameLength > remaining - records[i].nameOffset)
+            return {};
+    }
+
+    return {variantsHeader, records, reinterpret_cast<const char*>(records + variantsHeader->variantCount)};
+}
+
+class ShaderContainerView {
+public:
+    ShaderContainerView() = default;
+
+    ShaderContainerView(const void* data, size_t size) {
+        open(data, size);
+    }
+
+    //Validates the header and the section table, the memory has to stay alive as long as the view is used.
+    //For the payload alignment to hold, `data` itself has to be 16 byte aligned (mmap always is).
+    bool open(const void* data, size_t size) {
+        base = nullptr;
+        containerSize = 0;
+        if (!data || size < sizeof(ContainerHeader))
+            return false;
+
+        const ContainerHeader* candidate = static_cast<const ContainerHeader*>(data);
+        if (candidate->magic != CONTAINER_MAGIC || candidate->versionMajor != CONTAINER_VERSION_MAJOR ||
+            candidate->fileSize > size || candidate->sectionTableOffset % alignof(SectionEntry) != 0 ||
+            candidate->sectionTableOffset > candidate->fileSize ||
+            (candidate->fileSize - candidate->sectionTableOffset) / sizeof(SectionEntry) < candidate->sectionCount)
+            return false;
+
+        const SectionEntry* sections = reinterpret_cast<const SectionEntry*>(static_cast<const uint8_t*>(data) + candidate->sectionTableOffset);
+        for (uint32_t i = 0; i < candidate->sectionCount; i++) {
+            if (sections[i].offset > candidate->fileSize || sections[i].size > candidate->fileSize - sections[i].offset ||
+                (sections[i].flags & ~KNOWN_SECTION_FLAGS) != 0)
+                return false;
+        }
+
+        base = static_cast<const uint8_t*>(data);
+        containerSize = candidate->fileSize;
+
+        return true;
+    }
+
+    bool isValid() const {
+        return base != nullptr;
+    }
+
+    const ContainerHeader& header() const {
+        return *reinterpret_cast<const ContainerHeader*>(base);
+    }
+
+    uint32_t sectionCount() const {
+        return base ? header().sectionCount : 0;
+    }
+
+    const SectionEntry& sectionEntry(uint32_t i) const {
+        return reinterpret_cast<const SectionEntry*>(base + header().sectionTableOffset)[i];
+    }
+
+    const SectionEntry* findSection(SectionType type, uint32_t index = 0) const {
+        for (uint32_t i = 0; i < sectionCount(); i++) {
+            const SectionEntry& entry = sectionEntry(i);
+            if (entry.type == (uint32_t)type && entry.index == index)
+                return &entry;
+        }
+
+        return nullptr;
+    }
+
+    //The bytes as stored, compressed or not
+    SectionData section(SectionType type, uint32_t index = 0) const {
+        const SectionEntry* entry = findSection(type, index);
+        if (!entry)
+            return {};
+
+        return {base + entry->offset, (size_t)entry->size};
+    }
+
+    bool isCompressed(SectionType type, uint32_t index = 0) const {
+        const SectionEntry* entry = findSection(type, index);
+
+        return entry && (entry->flags & SECTION_FLAG_COMPRESSED);
+    }
+
+    //Streams the section, compressed or not. `dictionary` is the one given to the compiler with --dictionary, only
+    //needed if the section was compressed with it, and hashed to check that it is that one. Returns false if there is
+    //no such section or it can't be decoded, e.g. because it was compressed with a different dictionary.
+    bool sectionDecoder(SectionType type, uint32_t index, SectionDecoder& decoder, SectionData dictionary = {}) const {
+        const SectionEntry* entry = findSection(type, index);
+        if (!entry)
+            return false;
+
+        bool compressed = (entry->flags & SECTION_FLAG_COMPRESSED);
+        const CompressedSectionHeader* compressedHeader = compressedSectionHeader(base + entry->offset, (size_t)entry->size);
+        if (compressed && compressedHeader && compressedHeader->dictionaryHash != 0) {
+            //Only the part in reach of the matches is hashed, like the compiler does
+            size_t skipped = (dictionary.size > MAX_DICTIONARY_SIZE ? dictionary.size - MAX_DICTIONARY_SIZE : 0);
+            if (dictionary.size == 0 || hashBytes(static_cast<const uint8_t*>(dictionary.data) + skipped, dictionary.size - skipped) != compressedHeader->dictionaryHash)
+                return false;
+        }
+
+        return decoder.open(base + entry->offset, (size_t)entry->size, compressed, dictionary.data, dictionary.size);
+    }
+
+    //SPIR-V words, ready to be passed to vkCreateShaderModule
+    const uint32_t* spirv(size_t& wordCount, uint32_t payload = 0) const {
+        SectionData data = uncompressedSection(SectionType::SpirV, payload);
+        wordCount = data.size / sizeof(uint32_t);
+
+        return static_cast<const uint32_t*>(data.data);
+    }
+
+    SectionData metallib(uint32_t payload = 0) const {
+        return uncompressedSection(SectionType::Metallib, payload);
+    }
+
+    //Not null terminated
+    std::string_view glslSource(uint32_t payload = 0) const {
+        SectionData data = uncompressedSection(SectionType::GlslSource, payload);
+
+        return std::string_view(static_cast<const char*>(data.data), data.size);
+    }
+
+    std::string_view hlslSource(uint32_t payload = 0) const {
+        SectionData data = uncompressedSection(SectionType::HlslSource, payload);
+
+        return std::string_view(static_cast<const char*>(data.data), data.size);
+    }
+
+    ReflectionView reflection(uint32_t payload = 0) const {
+        return parseReflection(section(SectionType::Reflection, payload));
+    }
+
+    //Empty if the container carries its own metallib
+    MetalFunctionView metalFunction(uint32_t payload = 0) const {
+        return parseMetalFunction(section(SectionType::MetalFunction, payload));
+    }
+
+    //Empty for anything but vertex shaders with inputs
+    VertexInputsView vertexInputs(uint32_t payload = 0) const {
+        return parseVertexInputs(section(SectionType::VertexInputs, payload));
+    }
+
+    //Empty for shaders without permutations, VariantRecord::payloadIndex selects the payload for the accessors above
+    VariantsView variants() const {
+        return parseVariants(section(SectionType::Variants));
+    }
+
+private:
+    const uint8_t* base = nullptr;
+    uint64_t containerSize = 0;
+
+    SectionData uncompressedSection(SectionType type, uint32_t index) const {
+        return isCompressed(type, index) ? SectionData() : section(type, index);
+    }
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+//Read-only mapping of a whole file
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    ~MappedFile() {
+        close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const char* path) {
+        close();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat result;
+        if (fstat(fd, &result) != 0 || result.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+
+        void* mapping = mmap(nullptr, (size_t)result.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+            return false;
+
+        mappedData = mapping;
+        mappedSize = (size_t)result.st_size;
+
+        return true;
+    }
+
+    void close() {
+        if (mappedData)
+            munmap(mappedData, mappedSize);
+        mappedData = nullptr;
+        mappedSize = 0;
+    }
+
+    const void* data() const {
+        return mappedData;
+    }
+
+    size_t size() const {
+        return mappedSize;
+    }
+
+private:
+    void* mappedData = nullptr;
+    size_t mappedSize = 0;
+};
+#endif
+
+} //namespace lv
+
+#endif
@@ -0,0 +1,54 @@
+#include "shader_container_writer.hpp"
+
+#include "hash.hpp"
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+void ShaderContainerWriter::addSection(lv::SectionType type, uint32_t index, const void* data, size_t size, uint32_t alignment, uint32_t flags) {
+    sections.push_back({type, index, data, size, alignment, flags});
+}
+
+std::string ShaderContainerWriter::finish() const {
+    std::string data;
+    finish(data);
+
+    return data;
+}
+
+void ShaderContainerWriter::finish(std::string& data) const {
+    lv::ContainerHeader header{};
+    header.magic = lv::CONTAINER_MAGIC;
+    header.versionMajor = lv::CONTAINER_VERSION_MAJOR;
+    header.versionMinor = lv::CONTAINER_VERSION_MINOR;
+    header.headerSize = sizeof(lv::ContainerHeader);
+    header.sectionCount = (uint32_t)sections.size();
+    header.sectionTableOffset = sizeof(lv::ContainerHeader);
+
+    //Lay the payloads out first, so the whole file can be allocated at once
+    std::vector<lv::SectionEntry> entries(sections.size());
+    uint64_t offset = header.sectionTableOffset + sections.size() * sizeof(lv::SectionEntry);
+    for (size_t i = 0; i < sections.size(); i++) {
+        auto& section = sections[i];
+        auto& entry = entries[i];
+        offset = alignUp(offset, section.alignment);
+        entry.type = (uint32_t)section.type;
+        entry.index = section.index;
+        entry.offset = offset;
+        entry.size = section.size;
+        entry.hash = hashBytes(section.data, section.size);
+        entry.alignment = section.alignment;
+        entry.flags = section.flags;
+        offset += section.size;
+    }
+    header.fileSize = offset;
+
+    data.assign(offset, '\0');
+    memcpy(data.data(), &header, sizeof(header));
+    memcpy(data.data() + header.sectionTableOffset, entries.data(), entries.size() * sizeof(lv::SectionEntry));
+    for (size_t i = 0; i < sections.size(); i++) {
+        if (sections[i].size > 0)
+            memcpy(data.data() + entries[i].offset, sections[i].data, sections[i].size);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef LV_SHADER_CONTAINER_WRITER_H
+#define LV_SHADER_CONTAINER_WRITER_H
+
+#include <string>
+#include <vector>
+
+#include "shader_container.hpp"
+
+//Assembles a container from sections. Only pointers to the payloads are kept, so they have to stay alive until finish().
+class ShaderContainerWriter {
+public:
+    //`flags` is SECTION_FLAG_COMPRESSED for a payload already compressed by SectionCompressor
+    void addSection(lv::SectionType type, uint32_t index, const void* data, size_t size, uint32_t alignment = lv::CONTAINER_PAYLOAD_ALIGNMENT, uint32_t flags = 0);
+
+    //Drops the sections but keeps the table's memory, for assembling the next container
+    void clear() {
+        sections.clear();
+    }
+
+    //Returns the complete file: header, section table and the aligned payloads
+    std::string finish() const;
+
+    //Same, into `data`, whose memory is reused
+    void finish(std::string& data) const;
+
+private:
+    struct PendingSection {
+        lv::SectionType type;
+        uint32_t index;
+        const void* data;
+        size_t size;
+        uint32_t alignment;
+        uint32_t flags;
+    };
+
+    std::vector<PendingSection> sections;
+};
+
+#endif
@@ -0,0 +1,292 @@
+#include <iostream>
+#include <string>
+
+#include <json/json.h>
+
+#include "hash.hpp"
+#include "shader_container.hpp"
+#include "shader_pack.hpp"
+
+namespace nh = nlohmann;
+
+//Debugging aid: prints a compiled shader container or a shader pack as JSON
+const char* stageName(uint32_t stage) {
+    switch ((lv::ContainerStage)stage) {
+    case lv::ContainerStage::Vertex:
+        return "vertex";
+    case lv::ContainerStage::Fragment:
+        return "fragment";
+    case lv::ContainerStage::Compute:
+        return "compute";
+    }
+
+    return "unknown";
+}
+
+const char* descriptorTypeName(uint32_t descriptorType) {
+    switch ((lv::DescriptorType)descriptorType) {
+    case lv::DescriptorType::Buffer:
+        return "buffer";
+    case lv::DescriptorType::CombinedImageSampler:
+        return "combinedImageSampler";
+    case lv::DescriptorType::Image:
+        return "image";
+    }
+
+    return "unknown";
+}
+
+nh::json dumpReflection(const lv::ReflectionView& reflection) {
+    nh::json reflectionJSON;
+    reflectionJSON["stage"] = stageName(reflection.header->stage);
+    if (reflection.header->pushConstantBufferBinding != lv::INVALID_BINDING)
+        reflectionJSON["pushConstant"]["bufferBinding"] = reflection.header->pushConstantBufferBinding;
+
+    reflectionJSON["descriptorSets"] = nh::json::object();
+    for (uint32_t set = 0; set < reflection.setCount(); set++)
+        reflectionJSON["descriptorSets"][std::to_string(set)]["bindingSlots"] = reflection.setBindingCount(set);
+    for (uint32_t i = 0; i < reflection.bindingCount(); i++) {
+        const lv::BindingRecord& record = reflection.bindings[i];
+        auto& binding = reflectionJSON["descriptorSets"][std::to_string(record.set)]["bindings"][std::to_string(record.binding)];
+        binding["descriptorType"] = descriptorTypeName(record.descriptorType);
+        if (reflection.setCount() > 0)
+            binding["indexValid"] = (reflection.find(record.set, record.binding) == &record);
+        if (record.bufferBinding != lv::INVALID_BINDING)
+            binding["bufferBinding"] = record.bufferBinding;
+        if (record.textureBinding != lv::INVALID_BINDING)
+            binding["textureBinding"] = record.textureBinding;
+        if (record.samplerBinding != lv::INVALID_BINDING)
+            binding["samplerBinding"] = record.samplerBinding;
+    }
+
+    return reflectionJSON;
+}
+
+nh::json dumpMetalFunction(const lv::MetalFunctionView& metalFunction) {
+    nh::json functionJSON;
+    functionJSON["library"] = std::string(metalFunction.library);
+    functionJSON["function"] = std::string(metalFunction.function);
+
+    return functionJSON;
+}
+
+const char* vertexInputTypeName(uint32_t baseType) {
+    switch ((lv::VertexInputType)baseType) {
+    case lv::VertexInputType::Float:
+        return "float";
+    case lv::VertexInputType::Half:
+        return "half";
+    case lv::VertexInputType::Int:
+        return "int";
+    case lv::VertexInputType::UInt:
+        return "uint";
+    }
+
+    return "unknown";
+}
+
+nh::json dumpVertexInputs(const lv::VertexInputsView& vertexInputs) {
+    nh::json vertexInputsJSON = nh::json::array();
+    for (uint32_t i = 0; i < vertexInputs.count; i++) {
+        const lv::VertexInputRecord& record = vertexInputs.records[i];
+        vertexInputsJSON.push_back({{"location", record.location}, {"type", vertexInputTypeName(record.baseType)}, {"componentCount", record.componentCount}});
+    }
+
+    return vertexInputsJSON;
+}
+
+nh::json dumpVariants(const lv::VariantsView& variants) {
+    nh::json variantsJSON = nh::json::array();
+    for (uint32_t i = 0; i < variants.variantCount(); i++) {
+        const lv::VariantRecord& record = variants.records[i];
+        nh::json variantJSON;
+        variantJSON["name"] = std::string(variants.name(record));
+        variantJSON["key"] = hashToHex(record.key);
+        variantJSON["payloadIndex"] = record.payloadIndex;
+        //Goes through the binary search and recomputes the key from the name
+        variantJSON["indexValid"] = (variants.find(variants.name(record)) == &record);
+        variantsJSON.push_back(variantJSON);
+    }
+
+    return variantsJSON;
+}
+
+//Codec and uncompressed size of a compressed section. `decoder` is open on it if it could be decoded at all, decodeValid
+//then says whether the whole section decodes.
+nh::json dumpCompression(lv::SectionData data, lv::SectionDecoder* decoder) {
+    nh::json compressionJSON;
+    const lv::CompressedSectionHeader* header = lv::compressedSectionHeader(data.data, data.size);
+    if (!header)
+        return compressionJSON;
+    compressionJSON["codec"] = (header->codec == (uint32_t)lv::SectionCodec::Lz4 ? "lz4" : "unknown");
+    compressionJSON["uncompressedSize"] = header->uncompressedSize;
+    if (header->dictionaryHash != 0)
+        compressionJSON["dictionaryHash"] = hashToHex(header->dictionaryHash);
+    if (decoder) {
+        std::string decoded((size_t)decoder->size(), '\0');
+        compressionJSON["decodeValid"] = decoder->readAll(decoded.data());
+    }
+
+    return compressionJSON;
+}
+
+//Reflection and metal function of every payload. Shaders without permutations keep the flat layout of payload 0.
+template<typename Source>
+void dumpPayloads(const Source& source, nh::json& shaderJSON) {
+    lv::VariantsView variants = source.variants();
+    if (!variants) {
+        lv::ReflectionView reflection = source.reflection(0);
+        if (reflection)
+            shaderJSON["reflection"] = dumpReflection(reflection);
+        lv::MetalFunctionView metalFunction = source.metalFunction(0);
+        if (metalFunction)
+            shaderJSON["metalFunction"] = dumpMetalFunction(metalFunction);
+        lv::VertexInputsView vertexInputs = source.vertexInputs(0);
+        if (vertexInputs)
+            shaderJSON["vertexInputs"] = dumpVertexInputs(vertexInputs);
+        return;
+    }
+
+    shaderJSON["variants"] = dumpVariants(variants);
+    shaderJSON["payloads"] = nh::json::array();
+    for (uint32_t payload = 0; payload < variants.payloadCount(); payload++) {
+        nh::json payloadJSON;
+        lv::ReflectionView reflection = source.reflection(payload);
+        if (reflection)
+            payloadJSON["reflection"] = dumpReflection(reflection);
+        lv::MetalFunctionView metalFunction = source.metalFunction(payload);
+        if (metalFunction)
+            payloadJSON["metalFunction"] = dumpMetalFunction(metalFunction);
+        lv::VertexInputsView vertexInputs = source.vertexInputs(payload);
+        if (vertexInputs)
+            payloadJSON["vertexInputs"] = dumpVertexInputs(vertexInputs);
+        shaderJSON["payloads"].push_back(payloadJSON);
+    }
+}
+
+//Binds a pack entry, so that dumpPayloads() sees the same accessors as on a container
+struct PackEntrySource {
+    const lv::ShaderPackView& pack;
+    const lv::PackEntry& entry;
+
+    lv::VariantsView variants() const {
+        return pack.variants(entry);
+    }
+
+    lv::ReflectionView reflection(uint32_t payload) const {
+        return pack.reflection(entry, payload);
+    }
+
+    lv::MetalFunctionView metalFunction(uint32_t payload) const {
+        return pack.metalFunction(entry, payload);
+    }
+
+    lv::VertexInputsView vertexInputs(uint32_t payload) const {
+        return pack.vertexInputs(entry, payload);
+    }
+};
+
+nh::json dumpPack(const lv::ShaderPackView& pack) {
+    nh::json packJSON;
+    const lv::PackHeader& header = pack.header();
+    packJSON["version"] = std::to_string(header.versionMajor) + "." + std::to_string(header.versionMinor);
+    packJSON["fileSize"] = header.fileSize;
+    packJSON["pageSize"] = header.pageSize;
+    packJSON["blobCount"] = header.blobCount;
+    packJSON["buildHash"] = hashToHex(header.buildHash);
+    if (pack.dictionary())
+        packJSON["dictionarySize"] = pack.dictionary().size;
+
+    packJSON["shaders"] = nh::json::array();
+    for (uint32_t i = 0; i < pack.entryCount(); i++) {
+        const lv::PackEntry& entry = pack.entry(i);
+        std::string_view name = pack.entryName(entry);
+        nh::json shaderJSON;
+        shaderJSON["stage"] = stageName(entry.stage);
+        shaderJSON["name"] = std::string(name);
+        //Goes through the index, so a broken perfect hash shows up here
+        shaderJSON["indexValid"] = (pack.find((lv::ContainerStage)entry.stage, name) == &entry);
+
+        shaderJSON["sections"] = nh::json::array();
+        for (uint32_t payload = 0; payload < pack.variants(entry).payloadCount(); payload++) {
+            for (lv::SectionType type : {lv::SectionType::Reflection, lv::SectionType::SpirV, lv::SectionType::Metallib, lv::SectionType::GlslSource, lv::SectionType::HlslSource, lv::SectionType::MetalFunction, lv::SectionType::Variants, lv::SectionType::VertexInputs}) {
+                lv::SectionData data = pack.section(entry, type, payload);
+                if (!data)
+                    continue;
+
+                nh::json sectionJSON;
+                sectionJSON["type"] = lv::sectionTypeName((uint32_t)type);
+                sectionJSON["index"] = payload;
+                sectionJSON["offset"] = (uint64_t)(static_cast<const uint8_t*>(data.data) - reinterpret_cast<const uint8_t*>(&header));
+                sectionJSON["size"] = data.size;
+                if (pack.isCompressed(entry, type, payload)) {
+                    lv::SectionDecoder decoder;
+                    bool decodable = pack.sectionDecoder(entry, type, payload, decoder);
+                    sectionJSON["compression"] = dumpCompression(data, decodable ? &decoder : nullptr);
+                }
+                shaderJSON["sections"].push_back(sectionJSON);
+            }
+        }
+        dumpPayloads(PackEntrySource{pack, entry}, shaderJSON);
+        packJSON["shaders"].push_back(shaderJSON);
+    }
+
+    return packJSON;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        std::cout << "Usage: shader_dump <compiled shader or pack>" << std::endl;
+        return 1;
+    }
+
+    lv::MappedFile file;
+    if (!file.open(argv[1])) {
+        std::cout << "Error: could not open file '" << argv[1] << "'" << std::endl;
+        return 1;
+    }
+
+    lv::ShaderPackView pack;
+    if (pack.open(file.data(), file.size())) {
+        std::cout << dumpPack(pack).dump(4) << std::endl;
+        return 0;
+    }
+
+    lv::ShaderContainerView container;
+    if (!container.open(file.data(), file.size())) {
+        std::cout << "Error: '" << argv[1] << "' is not a valid shader container" << std::endl;
+        return 1;
+    }
+
+    nh::json containerJSON;
+    const lv::ContainerHeader& header = container.header();
+    containerJSON["version"] = std::to_string(header.versionMajor) + "." + std::to_string(header.versionMinor);
+    containerJSON["fileSize"] = header.fileSize;
+
+    containerJSON["sections"] = nh::json::array();
+    for (uint32_t i = 0; i < container.sectionCount(); i++) {
+        const lv::SectionEntry& entry = container.sectionEntry(i);
+        const uint8_t* payload = static_cast<const uint8_t*>(file.data()) + entry.offset;
+        nh::json sectionJSON;
+        sectionJSON["type"] = lv::sectionTypeName(entry.type);
+        sectionJSON["index"] = entry.index;
+        sectionJSON["offset"] = entry.offset;
+        sectionJSON["size"] = entry.size;
+        sectionJSON["alignment"] = entry.alignment;
+        sectionJSON["hash"] = hashToHex(entry.hash);
+        sectionJSON["hashValid"] = (hashBytes(payload, entry.size) == entry.hash);
+        //Sections compressed with a dictionary can only be decoded with the file given to the compiler
+        if (entry.flags & lv::SECTION_FLAG_COMPRESSED) {
+            lv::SectionDecoder decoder;
+            bool decodable = container.sectionDecoder((lv::SectionType)entry.type, entry.index, decoder);
+            sectionJSON["compression"] = dumpCompression({payload, (size_t)entry.size}, decodable ? &decoder : nullptr);
+        }
+        containerJSON["sections"].push_back(sectionJSON);
+    }
+
+    dumpPayloads(container, containerJSON);
+
+    std::cout << containerJSON.dump(4) << std::endl;
+
+    return 0;
+}
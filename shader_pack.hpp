@@ -0,0 +1,314 @@
+#ifndef LV_SHADER_PACK_H
+#define LV_SHADER_PACK_H
+
+//Header-only reader for shader packs (.lvpk): every compiled shader of a build in one file, loaded with a single mmap.
+//
+//Layout (little endian):
+//  PackHeader
+//  PackEntry[entryCount]
+//  uint32_t bucketSeeds[bucketCount]      perfect hash displacement per bucket
+//  uint32_t slots[slotCount]              entry index per slot, INVALID_PACK_INDEX for empty slots
+//  PackSectionRef[sectionRefCount]        the sections of every entry, consecutive per entry
+//  PackBlob[blobCount]                    deduplicated payloads, shared by all entries that reference them
+//  char strings[stringTableSize]          entry names
+//  payloads                               uncompressed SPIR-V and metallib at pageSize, everything else at 16 bytes
+//
+//Lookup: keyHash = packKeyHash(stage, name), bucket = keyHash % bucketCount,
+//slot = packSlotHash(keyHash, bucketSeeds[bucket]) % slotCount. One probe, no collisions.
+//
+//Sections are copied from the containers as they are, compressed ones included. The header names the blob holding the
+//dictionary they were compressed with, so a pack can always decode its own sections.
+//
+//Versions follow the container's (see shader_container.hpp): minor bumps only add what older readers can skip, anything
+//else bumps the major. 2.0 added compressed sections, the section flags and the dictionary blob.
+
+#include "shader_container.hpp"
+
+#include <string_view>
+
+namespace lv {
+
+const uint32_t PACK_MAGIC = 0x4b50564c; //"LVPK"
+const uint16_t PACK_VERSION_MAJOR = 2;
+const uint16_t PACK_VERSION_MINOR = 0;
+const uint32_t PACK_DEFAULT_PAGE_SIZE = 4096;
+
+const uint32_t INVALID_PACK_INDEX = 0xffffffff;
+
+struct PackHeader {
+    uint32_t magic;
+    uint16_t versionMajor;
+    uint16_t versionMinor;
+    uint32_t headerSize;
+    uint32_t pageSize;
+    uint32_t entryCount;
+    uint32_t bucketCount;
+    uint32_t slotCount;
+    uint32_t sectionRefCount;
+    uint32_t blobCount;
+    uint32_t stringTableSize;
+    uint64_t entriesOffset;
+    uint64_t bucketSeedsOffset;
+    uint64_t slotsOffset;
+    uint64_t sectionRefsOffset;
+    uint64_t blobsOffset;
+    uint64_t stringTableOffset;
+    uint64_t fileSize;
+    //Identifies the set of shaders and their cache keys, lets the compiler skip rewriting an up to date pack
+    uint64_t buildHash;
+    //INVALID_PACK_INDEX without compression dictionary
+    uint32_t dictionaryBlobIndex;
+    uint32_t reserved;
+};
+static_assert(sizeof(PackHeader) == 112, "PackHeader must be 112 bytes");
+
+struct PackEntry {
+    uint64_t keyHash;
+    uint32_t stage;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t firstSectionRef;
+    uint32_t sectionRefCount;
+    uint32_t reserved;
+};
+static_assert(sizeof(PackEntry) == 32, "PackEntry must be 32 bytes");
+
+struct PackSectionRef {
+    uint32_t type;
+    uint32_t index;
+    uint32_t blobIndex;
+    //SectionEntry::flags of the container
+    uint32_t flags;
+};
+static_assert(sizeof(PackSectionRef) == 16, "PackSectionRef must be 16 bytes");
+
+struct PackBlob {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t hash;
+};
+static_assert(sizeof(PackBlob) == 24, "PackBlob must be 24 bytes");
+
+//FNV-1a over the stage and the name, cheap enough to compute at runtime for every lookup
+inline uint64_t packKeyHash(ContainerStage stage, std::string_view name) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    auto mix = [&](uint8_t byte) {
+        hash ^= byte;
+        hash *= 0x100000001b3ULL;
+    };
+    mix((uint8_t)stage);
+    for (char c : name)
+        mix((uint8_t)c);
+
+    return hash;
+}
+
+inline uint64_t packSlotHash(uint64_t keyHash, uint32_t seed) {
+    uint64_t h = keyHash ^ ((uint64_t)seed * 0x9E3779B97F4A7C15ULL);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+class ShaderPackView {
+public:
+    ShaderPackView() = default;
+
+    ShaderPackView(const void* data, size_t size) {
+        open(data, size);
+    }
+
+    //Validates the header and the table bounds once, the memory has to stay alive as long as the view is used
+    bool open(const void* data, size_t size) {
+        base = nullptr;
+        if (!data || size < sizeof(PackHeader))
+            return false;
+
+        const PackHeader* candidate = static_cast<const PackHeader*>(data);
+        if (candidate->magic != PACK_MAGIC || candidate->versionMajor != PACK_VERSION_MAJOR || candidate->headerSize < sizeof(PackHeader) || candidate->fileSize > size ||
+            candidate->bucketCount == 0 || candidate->slotCount == 0 ||
+            !tableFits(candidate, candidate->entriesOffset, candidate->entryCount, sizeof(PackEntry)) ||
+            !tableFits(candidate, candidate->bucketSeedsOffset, candidate->bucketCount, sizeof(uint32_t)) ||
+            !tableFits(candidate, candidate->slotsOffset, candidate->slotCount, sizeof(uint32_t)) ||
+            !tableFits(candidate, candidate->sectionRefsOffset, candidate->sectionRefCount, sizeof(PackSectionRef)) ||
+            !tableFits(candidate, candidate->blobsOffset, candidate->blobCount, sizeof(PackBlob)) ||
+            !tableFits(candidate, candidate->stringTableOffset, candidate->stringTableSize, 1))
+            return false;
+
+        base = static_cast<const uint8_t*>(data);
+        bool valid = (dictionaryBlobIndex() == INVALID_PACK_INDEX || dictionaryBlobIndex() < candidate->blobCount);
+        for (uint32_t i = 0; i < candidate->entryCount; i++) {
+            const PackEntry& packEntry = entries()[i];
+            valid &= (packEntry.nameOffset <= candidate->stringTableSize && packEntry.nameLength <= candidate->stringTableSize - packEntry.nameOffset);
+            valid &= (packEntry.firstSectionRef <= candidate->sectionRefCount && packEntry.sectionRefCount <= candidate->sectionRefCount - packEntry.firstSectionRef);
+        }
+        for (uint32_t i = 0; i < candidate->sectionRefCount; i++)
+            valid &= ((table<PackSectionRef>(candidate->sectionRefsOffset)[i].flags & ~KNOWN_SECTION_FLAGS) == 0);
+        for (uint32_t i = 0; i < candidate->blobCount; i++) {
+            const PackBlob& blob = blobs()[i];
+            valid &= (blob.offset <= candidate->fileSize && blob.size <= candidate->fileSize - blob.offset);
+        }
+        if (!valid)
+            base = nullptr;
+
+        return valid;
+    }
+
+    bool isValid() const {
+        return base != nullptr;
+    }
+
+    const PackHeader& header() const {
+        return *reinterpret_cast<const PackHeader*>(base);
+    }
+
+    uint32_t entryCount() const {
+        return base ? header().entryCount : 0;
+    }
+
+    const PackEntry& entry(uint32_t i) const {
+        return entries()[i];
+    }
+
+    std::string_view entryName(const PackEntry& entry) const {
+        return std::string_view(reinterpret_cast<const char*>(base + header().stringTableOffset) + entry.nameOffset, entry.nameLength);
+    }
+
+    //O(1): one bucket seed, one slot, one key comparison
+    const PackEntry* find(ContainerStage stage, std::string_view name) const {
+        if (!base)
+            return nullptr;
+
+        const PackHeader& packHeader = header();
+        uint64_t keyHash = packKeyHash(stage, name);
+        uint32_t seed = table<uint32_t>(packHeader.bucketSeedsOffset)[keyHash % packHeader.bucketCount];
+        uint32_t entryIndex = table<uint32_t>(packHeader.slotsOffset)[packSlotHash(keyHash, seed) % packHeader.slotCount];
+        if (entryIndex >= packHeader.entryCount)
+            return nullptr;
+
+        const PackEntry& candidate = entries()[entryIndex];
+        if (candidate.keyHash != keyHash || candidate.stage != (uint32_t)stage || entryName(candidate) != name)
+            return nullptr;
+
+        return &candidate;
+    }
+
+    //The bytes as stored, compressed or not
+    SectionData section(const PackEntry& entry, SectionType type, uint32_t index = 0) const {
+        const PackSectionRef* ref = findSectionRef(entry, type, index);
+        if (!ref)
+            return {};
+
+        const PackBlob& blob = blobs()[ref->blobIndex];
+
+        return {base + blob.offset, (size_t)blob.size};
+    }
+
+    bool isCompressed(const PackEntry& entry, SectionType type, uint32_t index = 0) const {
+        const PackSectionRef* ref = findSectionRef(entry, type, index);
+
+        return ref && (ref->flags & SECTION_FLAG_COMPRESSED);
+    }
+
+    //The dictionary every compressed section of the pack was compressed with, empty if there is none
+    SectionData dictionary() const {
+        if (dictionaryBlobIndex() == INVALID_PACK_INDEX)
+            return {};
+
+        const PackBlob& blob = blobs()[dictionaryBlobIndex()];
+
+        return {base + blob.offset, (size_t)blob.size};
+    }
+
+    //Streams the section, compressed or not, with the pack's own dictionary. Returns false if there is no such section
+    //or it can't be decoded, e.g. because it was compressed with a different dictionary.
+    bool sectionDecoder(const PackEntry& entry, SectionType type, uint32_t index, SectionDecoder& decoder) const {
+        const PackSectionRef* ref = findSectionRef(entry, type, index);
+        if (!ref)
+            return false;
+
+        SectionData data = section(entry, type, index);
+        bool compressed = (ref->flags & SECTION_FLAG_COMPRESSED);
+        const CompressedSectionHeader* compressedHeader = compressedSectionHeader(data.data, data.size);
+        if (compressed && compressedHeader && compressedHeader->dictionaryHash != 0 &&
+            (dictionaryBlobIndex() == INVALID_PACK_INDEX || blobs()[dictionaryBlobIndex()].hash != compressedHeader->dictionaryHash))
+            return false;
+        SectionData packDictionary = dictionary();
+
+        return decoder.open(data.data, data.size, compressed, packDictionary.data, packDictionary.size);
+    }
+
+    //Empty if the section is compressed, use sectionDecoder() for those
+    const uint32_t* spirv(const PackEntry& entry, size_t& wordCount, uint32_t payload = 0) const {
+        SectionData data = uncompressedSection(entry, SectionType::SpirV, payload);
+        wordCount = data.size / sizeof(uint32_t);
+
+        return static_cast<const uint32_t*>(data.data);
+    }
+
+    SectionData metallib(const PackEntry& entry, uint32_t payload = 0) const {
+        return uncompressedSection(entry, SectionType::Metallib, payload);
+    }
+
+    ReflectionView reflection(const PackEntry& entry, uint32_t payload = 0) const {
+        return parseReflection(section(entry, SectionType::Reflection, payload));
+    }
+
+    MetalFunctionView metalFunction(const PackEntry& entry, uint32_t payload = 0) const {
+        return parseMetalFunction(section(entry, SectionType::MetalFunction, payload));
+    }
+
+    VertexInputsView vertexInputs(const PackEntry& entry, uint32_t payload = 0) const {
+        return parseVertexInputs(section(entry, SectionType::VertexInputs, payload));
+    }
+
+    VariantsView variants(const PackEntry& entry) const {
+        return parseVariants(section(entry, SectionType::Variants));
+    }
+
+private:
+    const uint8_t* base = nullptr;
+
+    static bool tableFits(const PackHeader* packHeader, uint64_t offset, uint64_t count, uint64_t elementSize) {
+        return offset <= packHeader->fileSize && (packHeader->fileSize - offset) / elementSize >= count;
+    }
+
+    template<typename T>
+    const T* table(uint64_t offset) const {
+        return reinterpret_cast<const T*>(base + offset);
+    }
+
+    const PackEntry* entries() const {
+        return table<PackEntry>(header().entriesOffset);
+    }
+
+    const PackBlob* blobs() const {
+        return table<PackBlob>(header().blobsOffset);
+    }
+
+    uint32_t dictionaryBlobIndex() const {
+        return header().dictionaryBlobIndex;
+    }
+
+    const PackSectionRef* findSectionRef(const PackEntry& entry, SectionType type, uint32_t index) const {
+        const PackSectionRef* refs = table<PackSectionRef>(header().sectionRefsOffset) + entry.firstSectionRef;
+        for (uint32_t i = 0; i < entry.sectionRefCount; i++) {
+            if (refs[i].type == (uint32_t)type && refs[i].index == index && refs[i].blobIndex < header().blobCount)
+                return &refs[i];
+        }
+
+        return nullptr;
+    }
+
+    SectionData uncompressedSection(const PackEntry& entry, SectionType type, uint32_t index) const {
+        return isCompressed(entry, type, index) ? SectionData() : section(entry, type, index);
+    }
+};
+
+} //namespace lv
+
+#endif
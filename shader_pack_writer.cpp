@@ -0,0 +1,198 @@
+#include "shader_pack_writer.hpp"
+
+#include <algorithm>
+
+#include "hash.hpp"
+
+//Seeds tried per bucket before the slot table is grown
+const uint32_t MAX_BUCKET_SEED = 1 << 16;
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+//Hash and displace: buckets are placed largest first, each one gets the first seed that puts all of its keys
+//into free slots. With ~4 keys per bucket and a load factor of 0.8 this takes a handful of tries per bucket.
+static bool buildPerfectHash(const std::vector<uint64_t>& keyHashes, uint32_t bucketCount, uint32_t slotCount, std::vector<uint32_t>& seeds, std::vector<uint32_t>& slots) {
+    std::vector<std::vector<uint32_t>> buckets(bucketCount);
+    for (uint32_t i = 0; i < keyHashes.size(); i++)
+        buckets[keyHashes[i] % bucketCount].push_back(i);
+
+    std::vector<uint32_t> bucketOrder(bucketCount);
+    for (uint32_t i = 0; i < bucketCount; i++)
+        bucketOrder[i] = i;
+    std::stable_sort(bucketOrder.begin(), bucketOrder.end(), [&](uint32_t a, uint32_t b) {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+    seeds.assign(bucketCount, 0);
+    slots.assign(slotCount, lv::INVALID_PACK_INDEX);
+    std::vector<uint32_t> candidateSlots;
+    for (uint32_t bucketIndex : bucketOrder) {
+        auto& bucket = buckets[bucketIndex];
+        if (bucket.empty())
+            break;
+
+        bool placed = false;
+        for (uint32_t seed = 0; seed < MAX_BUCKET_SEED && !placed; seed++) {
+            candidateSlots.clear();
+            placed = true;
+            for (uint32_t keyIndex : bucket) {
+                uint32_t slot = (uint32_t)(lv::packSlotHash(keyHashes[keyIndex], seed) % slotCount);
+                if (slots[slot] != lv::INVALID_PACK_INDEX || std::find(candidateSlots.begin(), candidateSlots.end(), slot) != candidateSlots.end()) {
+                    placed = false;
+                    break;
+                }
+                candidateSlots.push_back(slot);
+            }
+
+            if (placed) {
+                seeds[bucketIndex] = seed;
+                for (size_t i = 0; i < bucket.size(); i++)
+                    slots[candidateSlots[i]] = bucket[i];
+            }
+        }
+        if (!placed)
+            return false;
+    }
+
+    return true;
+}
+
+uint32_t ShaderPackWriter::addBlob(const void* data, size_t size, uint64_t hash, uint32_t alignment) {
+    auto range = blobsByHash.equal_range(hash);
+    for (auto it = range.first; it != range.second; it++) {
+        PendingBlob& blob = blobs[it->second];
+        if (blob.data.size() == size && (size == 0 || memcmp(blob.data.data(), data, size) == 0)) {
+            blob.alignment = std::max(blob.alignment, alignment);
+            return it->second;
+        }
+    }
+
+    uint32_t blobIndex = (uint32_t)blobs.size();
+    blobs.push_back({std::string(static_cast<const char*>(data), size), hash, alignment});
+    blobsByHash.emplace(hash, blobIndex);
+
+    return blobIndex;
+}
+
+void ShaderPackWriter::setDictionary(std::string_view dictionary) {
+    dictionaryBlobIndex = (dictionary.empty() ? lv::INVALID_PACK_INDEX : addBlob(dictionary.data(), dictionary.size(), hashBytes(dictionary.data(), dictionary.size()), lv::CONTAINER_PAYLOAD_ALIGNMENT));
+}
+
+bool ShaderPackWriter::addShader(lv::ContainerStage stage, std::string_view name, const lv::ShaderContainerView& container) {
+    //The key hash is the only thing the index stores, so two keys with the same hash could never both be found
+    uint64_t keyHash = lv::packKeyHash(stage, name);
+    for (auto& shader : shaders) {
+        if (shader.keyHash == keyHash)
+            return false;
+    }
+
+    PendingShader shader;
+    shader.stage = stage;
+    shader.name = name;
+    shader.keyHash = keyHash;
+    for (uint32_t i = 0; i < container.sectionCount(); i++) {
+        const lv::SectionEntry& entry = container.sectionEntry(i);
+        lv::SectionData data = container.section((lv::SectionType)entry.type, entry.index);
+        //Compressed sections are decoded into memory of their own, only the ones used in place benefit from page alignment
+        bool pageAligned = ((entry.type == (uint32_t)lv::SectionType::SpirV || entry.type == (uint32_t)lv::SectionType::Metallib) && !(entry.flags & lv::SECTION_FLAG_COMPRESSED));
+        uint32_t alignment = (pageAligned ? pageSize : lv::CONTAINER_PAYLOAD_ALIGNMENT);
+        shader.sectionRefs.push_back({entry.type, entry.index, addBlob(data.data, data.size, entry.hash, alignment), entry.flags});
+    }
+    shaders.push_back(std::move(shader));
+
+    return true;
+}
+
+std::string ShaderPackWriter::finish() const {
+    //Sorted by stage and name, so the same set of shaders always produces the same file
+    std::vector<const PendingShader*> sortedShaders;
+    for (auto& shader : shaders)
+        sortedShaders.push_back(&shader);
+    std::sort(sortedShaders.begin(), sortedShaders.end(), [](const PendingShader* a, const PendingShader* b) {
+        return a->stage != b->stage ? a->stage < b->stage : a->name < b->name;
+    });
+
+    std::vector<uint64_t> keyHashes;
+    for (auto shader : sortedShaders)
+        keyHashes.push_back(shader->keyHash);
+
+    uint32_t entryCount = (uint32_t)sortedShaders.size();
+    uint32_t bucketCount = std::max<uint32_t>((entryCount + 3) / 4, 1);
+    uint32_t slotCount = std::max<uint32_t>(entryCount + entryCount / 4, 1);
+    std::vector<uint32_t> seeds, slots;
+    while (!buildPerfectHash(keyHashes, bucketCount, slotCount, seeds, slots))
+        slotCount *= 2;
+
+    std::vector<lv::PackEntry> entries(entryCount);
+    std::vector<lv::PackSectionRef> sectionRefs;
+    std::string strings;
+    for (uint32_t i = 0; i < entryCount; i++) {
+        const PendingShader& shader = *sortedShaders[i];
+        lv::PackEntry& entry = entries[i];
+        entry.keyHash = shader.keyHash;
+        entry.stage = (uint32_t)shader.stage;
+        entry.nameOffset = (uint32_t)strings.size();
+        entry.nameLength = (uint32_t)shader.name.size();
+        entry.firstSectionRef = (uint32_t)sectionRefs.size();
+        entry.sectionRefCount = (uint32_t)shader.sectionRefs.size();
+        entry.reserved = 0;
+        strings += shader.name;
+        sectionRefs.insert(sectionRefs.end(), shader.sectionRefs.begin(), shader.sectionRefs.end());
+    }
+
+    lv::PackHeader header{};
+    header.magic = lv::PACK_MAGIC;
+    header.versionMajor = lv::PACK_VERSION_MAJOR;
+    header.versionMinor = lv::PACK_VERSION_MINOR;
+    header.headerSize = sizeof(lv::PackHeader);
+    header.pageSize = pageSize;
+    header.entryCount = entryCount;
+    header.bucketCount = bucketCount;
+    header.slotCount = slotCount;
+    header.sectionRefCount = (uint32_t)sectionRefs.size();
+    header.blobCount = (uint32_t)blobs.size();
+    header.stringTableSize = (uint32_t)strings.size();
+    header.buildHash = buildHash;
+    header.dictionaryBlobIndex = dictionaryBlobIndex;
+
+    uint64_t offset = sizeof(lv::PackHeader);
+    header.entriesOffset = offset;
+    offset += entries.size() * sizeof(lv::PackEntry);
+    header.bucketSeedsOffset = offset;
+    offset += seeds.size() * sizeof(uint32_t);
+    header.slotsOffset = offset;
+    offset += slots.size() * sizeof(uint32_t);
+    header.sectionRefsOffset = offset;
+    offset += sectionRefs.size() * sizeof(lv::PackSectionRef);
+    header.blobsOffset = offset = alignUp(offset, alignof(lv::PackBlob));
+    offset += blobs.size() * sizeof(lv::PackBlob);
+    header.stringTableOffset = offset;
+    offset += strings.size();
+
+    std::vector<lv::PackBlob> blobTable(blobs.size());
+    for (size_t i = 0; i < blobs.size(); i++) {
+        offset = alignUp(offset, blobs[i].alignment);
+        blobTable[i] = {offset, blobs[i].data.size(), blobs[i].hash};
+        offset += blobs[i].data.size();
+    }
+    header.fileSize = offset;
+
+    std::string data(offset, '\0');
+    auto write = [&](uint64_t at, const void* src, size_t size) {
+        if (size > 0)
+            memcpy(data.data() + at, src, size);
+    };
+    write(0, &header, sizeof(header));
+    write(header.entriesOffset, entries.data(), entries.size() * sizeof(lv::PackEntry));
+    write(header.bucketSeedsOffset, seeds.data(), seeds.size() * sizeof(uint32_t));
+    write(header.slotsOffset, slots.data(), slots.size() * sizeof(uint32_t));
+    write(header.sectionRefsOffset, sectionRefs.data(), sectionRefs.size() * sizeof(lv::PackSectionRef));
+    write(header.blobsOffset, blobTable.data(), blobTable.size() * sizeof(lv::PackBlob));
+    write(header.stringTableOffset, strings.data(), strings.size());
+    for (size_t i = 0; i < blobs.size(); i++)
+        write(blobTable[i].offset, blobs[i].data.data(), blobs[i].data.size());
+
+    return data;
+}
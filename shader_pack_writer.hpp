@@ -0,0 +1,62 @@
+#ifndef LV_SHADER_PACK_WRITER_H
+#define LV_SHADER_PACK_WRITER_H
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "shader_pack.hpp"
+
+//Assembles a shader pack from compiled containers. Payloads are copied and deduplicated by content, so the
+//containers don't have to stay alive.
+class ShaderPackWriter {
+public:
+    explicit ShaderPackWriter(uint32_t pageSize = lv::PACK_DEFAULT_PAGE_SIZE) : pageSize(pageSize) {}
+
+    //Returns false if a shader with the same stage and name was already added
+    bool addShader(lv::ContainerStage stage, std::string_view name, const lv::ShaderContainerView& container);
+
+    void setBuildHash(uint64_t hash) {
+        buildHash = hash;
+    }
+
+    //The dictionary the compressed sections were compressed with, if any
+    void setDictionary(std::string_view dictionary);
+
+    size_t shaderCount() const {
+        return shaders.size();
+    }
+
+    size_t blobCount() const {
+        return blobs.size();
+    }
+
+    //Returns the complete file: header, index tables and the aligned payloads
+    std::string finish() const;
+
+private:
+    struct PendingBlob {
+        std::string data;
+        uint64_t hash;
+        uint32_t alignment;
+    };
+
+    struct PendingShader {
+        lv::ContainerStage stage;
+        std::string name;
+        uint64_t keyHash;
+        std::vector<lv::PackSectionRef> sectionRefs;
+    };
+
+    uint32_t pageSize;
+    uint64_t buildHash = 0;
+    uint32_t dictionaryBlobIndex = lv::INVALID_PACK_INDEX;
+    std::vector<PendingBlob> blobs;
+    std::unordered_multimap<uint64_t, uint32_t> blobsByHash;
+    std::vector<PendingShader> shaders;
+
+    uint32_t addBlob(const void* data, size_t size, uint64_t hash, uint32_t alignment);
+};
+
+#endif
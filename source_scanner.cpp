@@ -0,0 +1,210 @@
+#include "source_scanner.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string_view>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <dirent.h>
+#endif
+
+#include "build_cache.hpp"
+
+namespace fs = std::filesystem;
+
+const char* SNAPSHOT_MAGIC = "lava_source_snapshot";
+
+//A directory changed this recently may change again within the same mtime tick (a second on some file systems)
+//without its mtime moving, so its listing is not trusted on the next run
+const int64_t RACY_MTIME_WINDOW_NS = 2000000000;
+
+bool SourceScanner::load(const std::string& path) {
+    directories.clear();
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    std::string_view text(content);
+    DirectoryRecord* currentDirectory = nullptr;
+    bool headerRead = false;
+    while (!text.empty()) {
+        size_t lineEnd = text.find('\n');
+        std::string_view line = text.substr(0, lineEnd);
+        text = (lineEnd == std::string_view::npos ? std::string_view() : text.substr(lineEnd + 1));
+        if (line.size() < 2)
+            continue;
+
+        std::string_view type = line.substr(0, line.find(' '));
+        line.remove_prefix(std::min(line.size(), type.size() + 1));
+        if (!headerRead) {
+            uint32_t version = 0;
+            auto result = std::from_chars(line.data(), line.data() + line.size(), version);
+            if (type != SNAPSHOT_MAGIC || result.ec != std::errc() || version != SOURCE_SNAPSHOT_VERSION)
+                return false;
+            headerRead = true;
+        } else if (type == "d") {
+            DirectoryRecord record;
+            auto result = std::from_chars(line.data(), line.data() + line.size(), record.mtime);
+            if (result.ec != std::errc() || result.ptr == line.data() + line.size())
+                return false;
+            line.remove_prefix(result.ptr - line.data() + 1);
+            currentDirectory = &(directories[std::string(line)] = std::move(record));
+        } else if (type == "f" && currentDirectory) {
+            currentDirectory->files.emplace_back(line);
+        } else if (type == "s" && currentDirectory) {
+            currentDirectory->subdirs.emplace_back(line);
+        } else {
+            directories.clear();
+            return false;
+        }
+    }
+
+    return headerRead;
+}
+
+bool SourceScanner::save(const std::string& path) const {
+    std::string out;
+    out += SNAPSHOT_MAGIC;
+    out += " " + std::to_string(SOURCE_SNAPSHOT_VERSION) + "\n";
+    for (auto& [relDir, record] : directories) {
+        if (!record.seen)
+            continue;
+        out += "d " + std::to_string(record.mtime) + " " + relDir + "\n";
+        for (auto& name : record.files)
+            out += "f " + name + "\n";
+        for (auto& name : record.subdirs)
+            out += "s " + name + "\n";
+    }
+
+    //Same as the manifest, an interrupted run never leaves a truncated snapshot behind
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+        file.write(out.data(), out.size());
+        if (!file)
+            return false;
+    }
+
+    std::error_code error;
+    fs::rename(tempPath, path, error);
+
+    return !error;
+}
+
+bool SourceScanner::scan(const std::string& relDir, std::vector<std::string>& files) {
+    listedCount = 0;
+    files.clear();
+    if (!scanDirectory(relDir, files))
+        return false;
+    std::sort(files.begin(), files.end());
+
+    return true;
+}
+
+bool SourceScanner::scanDirectory(const std::string& relDir, std::vector<std::string>& files) {
+    FileStamp stamp;
+    if (!getFileStamp(rootDir + "/" + relDir, stamp)) {
+        dropDirectory(relDir);
+        return false;
+    }
+
+    //Node based, so the reference survives the inserts of the subdirectories
+    DirectoryRecord& record = directories[relDir];
+    record.seen = true;
+    if (record.mtime == 0 || record.mtime != stamp.mtime) {
+        std::vector<std::string> oldSubdirs = std::move(record.subdirs);
+        if (!listDirectory(relDir, record)) {
+            dropDirectory(relDir);
+            return false;
+        }
+        //Subdirectories that were removed or renamed are never visited again, their records would pile up otherwise
+        for (auto& name : oldSubdirs) {
+            if (std::find(record.subdirs.begin(), record.subdirs.end(), name) == record.subdirs.end())
+                dropDirectory(relDir + "/" + name);
+        }
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        record.mtime = (now - stamp.mtime < RACY_MTIME_WINDOW_NS ? 0 : stamp.mtime);
+        listedCount++;
+    }
+
+    for (auto& name : record.files)
+        files.push_back(relDir + "/" + name);
+    for (auto& name : record.subdirs)
+        scanDirectory(relDir + "/" + name, files);
+
+    return true;
+}
+
+void SourceScanner::dropDirectory(const std::string& relDir) {
+    std::string prefix = relDir + "/";
+    std::erase_if(directories, [&](const auto& entry) {
+        return entry.first == relDir || entry.first.starts_with(prefix);
+    });
+}
+
+bool SourceScanner::isIgnored(const std::string& name) const {
+    for (auto& prefix : ignoredPrefixes) {
+        if (name.rfind(prefix, 0) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+bool SourceScanner::listDirectory(const std::string& relDir, DirectoryRecord& record) {
+    record.files.clear();
+    record.subdirs.clear();
+    std::string path = rootDir + "/" + relDir;
+
+#ifndef WIN32
+    DIR* dir = opendir(path.c_str());
+    if (!dir)
+        return false;
+
+    while (const dirent* entry = readdir(dir)) {
+        std::string name(entry->d_name);
+        if (name == "." || name == "..")
+            continue;
+
+        //Only symlinks and file systems that don't report the type need a stat. Symlinked directories are not followed,
+        //so a link cycle can't make the scan recurse forever.
+        bool isDirectory = (entry->d_type == DT_DIR);
+        bool isFile = (entry->d_type == DT_REG);
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            struct stat result;
+            if (stat((path + "/" + name).c_str(), &result) != 0)
+                continue;
+            isDirectory = (entry->d_type == DT_UNKNOWN && S_ISDIR(result.st_mode));
+            isFile = S_ISREG(result.st_mode);
+        }
+
+        if (isFile)
+            record.files.push_back(std::move(name));
+        else if (isDirectory && !isIgnored(name))
+            record.subdirs.push_back(std::move(name));
+    }
+    closedir(dir);
+#else
+    std::error_code error;
+    for (auto& dirEntry : fs::directory_iterator(path, error)) {
+        std::string name = dirEntry.path().filename().string();
+        if (dirEntry.is_regular_file(error))
+            record.files.push_back(std::move(name));
+        else if (dirEntry.is_directory(error) && !dirEntry.is_symlink(error) && !isIgnored(name))
+            record.subdirs.push_back(std::move(name));
+    }
+    if (error)
+        return false;
+#endif
+
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef LV_SOURCE_SCANNER_H
+#define LV_SOURCE_SCANNER_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//Bump whenever the snapshot format changes
+const uint32_t SOURCE_SNAPSHOT_VERSION = 1;
+
+//One directory of the snapshot. The mtime of a directory changes whenever an entry is added, removed or renamed,
+//but not when a file in it is edited, so an unchanged mtime means the listing can be reused as is.
+struct DirectoryRecord {
+    int64_t mtime = 0;
+    std::vector<std::string> files;
+    std::vector<std::string> subdirs;
+    bool seen = false;
+};
+
+//Recursive listing of a source tree, kept between runs in a line based snapshot. Every directory costs a single stat,
+//only directories whose mtime changed are read again, and entries are told apart by the type readdir() reports instead
+//of a stat per file. The stat can't be skipped for whole subtrees, a change deep down doesn't touch the mtime of its
+//parents. All paths are relative to rootDir.
+class SourceScanner {
+public:
+    std::string rootDir;
+    //Subdirectories whose name starts with one of these are skipped
+    std::vector<std::string> ignoredPrefixes = {"."};
+
+    //Keyed by the relative path of the directory
+    std::unordered_map<std::string, DirectoryRecord> directories;
+
+    //Directories read during the last scan(), the rest came from the snapshot
+    size_t listedCount = 0;
+
+    bool load(const std::string& path);
+
+    bool save(const std::string& path) const;
+
+    //Every file below relDir, sorted. Returns false if relDir itself can't be read.
+    bool scan(const std::string& relDir, std::vector<std::string>& files);
+
+private:
+    bool scanDirectory(const std::string& relDir, std::vector<std::string>& files);
+
+    bool listDirectory(const std::string& relDir, DirectoryRecord& record);
+
+    //Forgets relDir and everything below it
+    void dropDirectory(const std::string& relDir);
+
+    bool isIgnored(const std::string& name) const;
+};
+
+#endif
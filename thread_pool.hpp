@@ -0,0 +1,142 @@
+#ifndef LV_THREAD_POOL_H
+#define LV_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Work-stealing thread pool. Every worker owns a deque: it pops its own work from the back
+//and steals from the front of the other workers' deques once its own deque runs dry.
+class ThreadPool {
+public:
+    using Task = std::function<void(uint32_t workerIndex)>;
+
+    explicit ThreadPool(uint32_t threadCount) {
+        if (threadCount == 0)
+            threadCount = 1;
+
+        queues.reserve(threadCount);
+        for (uint32_t i = 0; i < threadCount; i++)
+            queues.push_back(std::make_unique<WorkQueue>());
+
+        workers.reserve(threadCount);
+        for (uint32_t i = 0; i < threadCount; i++)
+            workers.emplace_back([this, i]() { workerLoop(i); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wakeCondition.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    uint32_t threadCount() const {
+        return (uint32_t)workers.size();
+    }
+
+    //Tasks are distributed round-robin, the stealing evens the load out afterwards
+    void submit(Task task) {
+        pendingTasks.fetch_add(1, std::memory_order_relaxed);
+        uint32_t queueIndex = nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(queues[queueIndex]->mutex);
+            queues[queueIndex]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            queuedTasks++;
+        }
+        wakeCondition.notify_one();
+    }
+
+    //Blocks until every submitted task has finished
+    void wait() {
+        std::unique_lock<std::mutex> lock(doneMutex);
+        doneCondition.wait(lock, [this]() { return pendingTasks.load(std::memory_order_acquire) == 0; });
+    }
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::atomic<uint32_t> nextQueue{0};
+    std::atomic<uint64_t> pendingTasks{0};
+
+    std::mutex sleepMutex;
+    std::condition_variable wakeCondition;
+    uint64_t queuedTasks = 0;
+    bool stopping = false;
+
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+
+    bool popLocal(uint32_t workerIndex, Task& task) {
+        auto& queue = *queues[workerIndex];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+            return false;
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+
+        return true;
+    }
+
+    bool steal(uint32_t workerIndex, Task& task) {
+        for (size_t i = 1; i < queues.size(); i++) {
+            auto& queue = *queues[(workerIndex + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void workerLoop(uint32_t workerIndex) {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                wakeCondition.wait(lock, [this]() { return stopping || queuedTasks > 0; });
+                if (queuedTasks == 0)
+                    return;
+                queuedTasks--;
+            }
+
+            //A queued task is reserved for this worker, so one of the deques is guaranteed to hold it
+            Task task;
+            while (!popLocal(workerIndex, task) && !steal(workerIndex, task))
+                std::this_thread::yield();
+
+            task(workerIndex);
+
+            if (pendingTasks.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lock(doneMutex);
+                doneCondition.notify_all();
+            }
+        }
+    }
+};
+
+#endif
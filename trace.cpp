@@ -0,0 +1,137 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+
+#include <json/json.h>
+
+namespace nh = nlohmann;
+
+BuildTrace::BuildTrace() : origin(Clock::now()) {
+    tracks[std::this_thread::get_id()] = 0;
+}
+
+uint32_t BuildTrace::currentTrack() {
+    auto track = tracks.find(std::this_thread::get_id());
+    if (track != tracks.end())
+        return track->second;
+
+    uint32_t index = (uint32_t)tracks.size();
+    tracks[std::this_thread::get_id()] = index;
+
+    return index;
+}
+
+void BuildTrace::record(const char* stage, std::string_view shader, Clock::time_point start, Clock::time_point end, uint64_t allocations, uint64_t peakResidentGrowth) {
+    int64_t startUs = std::chrono::duration_cast<std::chrono::microseconds>(start - origin).count();
+    int64_t durationUs = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    events.push_back({stage, std::string(shader), currentTrack(), startUs, durationUs, allocations, peakResidentGrowth});
+}
+
+bool BuildTrace::writeChromeTrace(const std::string& path) const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    nh::json traceEvents = nh::json::array();
+    for (uint32_t track = 0; track < tracks.size(); track++) {
+        traceEvents.push_back({
+            {"name", "thread_name"}, {"ph", "M"}, {"pid", 1}, {"tid", track},
+            {"args", {{"name", track == 0 ? std::string("main") : "worker " + std::to_string(track)}}}
+        });
+    }
+    for (auto& event : events) {
+        nh::json traceEvent = {
+            {"name", event.stage}, {"cat", "build"}, {"ph", "X"}, {"pid", 1}, {"tid", event.track},
+            {"ts", event.startUs}, {"dur", event.durationUs}, {"args", {{"allocations", event.allocations}, {"peakResidentGrowth", event.peakResidentGrowth}}}
+        };
+        if (!event.shader.empty())
+            traceEvent["args"]["shader"] = event.shader;
+        traceEvents.push_back(std::move(traceEvent));
+    }
+
+    std::ofstream file(path, std::ios::trunc);
+    if (!file)
+        return false;
+    nh::json otherData = {{"peakResidentBytes", peakResidentBytes()}};
+    file << nh::json({{"traceEvents", std::move(traceEvents)}, {"displayTimeUnit", "ms"}, {"otherData", std::move(otherData)}}).dump();
+
+    return (bool)file;
+}
+
+//Nearest rank percentile of sorted durations
+static int64_t percentile(const std::vector<int64_t>& sorted, uint32_t p) {
+    size_t rank = (sorted.size() * p + 99) / 100;
+
+    return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+void BuildTrace::printSummary(std::ostream& out, size_t slowestCount) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (events.empty())
+        return;
+
+    std::map<std::string_view, std::vector<int64_t>> stageDurations;
+    std::map<std::string_view, uint64_t> stageAllocations;
+    std::map<std::string_view, uint64_t> stagePeakGrowth;
+    std::vector<const Event*> shaders;
+    for (auto& event : events) {
+        stageDurations[event.stage].push_back(event.durationUs);
+        stageAllocations[event.stage] += event.allocations;
+        stagePeakGrowth[event.stage] = std::max(stagePeakGrowth[event.stage], event.peakResidentGrowth);
+        if (std::string_view(event.stage) == SHADER_TRACE_STAGE)
+            shaders.push_back(&event);
+    }
+
+    struct StageSummary {
+        std::string_view stage;
+        size_t count;
+        int64_t total;
+        int64_t p50;
+        int64_t p95;
+        uint64_t allocations;
+        uint64_t peakGrowth;
+    };
+    std::vector<StageSummary> summaries;
+    for (auto& [stage, durations] : stageDurations) {
+        std::sort(durations.begin(), durations.end());
+        int64_t total = 0;
+        for (int64_t duration : durations)
+            total += duration;
+        summaries.push_back({stage, durations.size(), total, percentile(durations, 50), percentile(durations, 95), stageAllocations[stage], stagePeakGrowth[stage]});
+    }
+    std::sort(summaries.begin(), summaries.end(), [](const StageSummary& a, const StageSummary& b) {
+        return a.total > b.total;
+    });
+
+    char line[256];
+    out << "\nStage                  Count    Total ms      p50 ms      p95 ms      Allocs  Peak RSS +MB\n";
+    for (auto& summary : summaries) {
+        snprintf(line, sizeof(line), "%-20.*s %7zu %11.2f %11.2f %11.2f %11llu %13.1f\n", (int)summary.stage.size(), summary.stage.data(),
+                 summary.count, summary.total / 1000.0, summary.p50 / 1000.0, summary.p95 / 1000.0, (unsigned long long)summary.allocations,
+                 summary.peakGrowth / (1024.0 * 1024.0));
+        out << line;
+    }
+    snprintf(line, sizeof(line), "\nProcess peak RSS %.1f MB\n", peakResidentBytes() / (1024.0 * 1024.0));
+    out << line;
+
+    if (shaders.empty() || slowestCount == 0)
+        return;
+
+    std::sort(shaders.begin(), shaders.end(), [](const Event* a, const Event* b) {
+        return a->durationUs > b->durationUs;
+    });
+    out << "\nSlowest shaders                                      ms\n";
+    for (size_t i = 0; i < std::min(slowestCount, shaders.size()); i++) {
+        snprintf(line, sizeof(line), "%-44s %11.2f\n", shaders[i]->shader.c_str(), shaders[i]->durationUs / 1000.0);
+        out << line;
+    }
+}
+
+void BuildTrace::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    events.clear();
+    origin = Clock::now();
+}
@@ -0,0 +1,91 @@
+#ifndef LV_TRACE_H
+#define LV_TRACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "memory_stats.hpp"
+
+//Name of the scope that spans a whole shader, the slowest shader list is built from these
+const char* const SHADER_TRACE_STAGE = "shader";
+
+//Timings of the pipeline stages of a build. Scopes can be recorded from any thread, every thread gets its own
+//track in the trace. The thread that creates the trace is track 0. Every scope also records the allocations its
+//thread made while it was open, nested scopes included, and how far the peak RSS of the process rose meanwhile. The
+//peak is process wide, a rise during overlapping scopes on other threads is seen by all of them.
+class BuildTrace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Event {
+        const char* stage;
+        std::string shader;
+        uint32_t track;
+        int64_t startUs;
+        int64_t durationUs;
+        uint64_t allocations;
+        uint64_t peakResidentGrowth;
+    };
+
+    //Nothing is recorded unless enabled, a disabled scope doesn't even read the clock
+    bool enabled = false;
+
+    BuildTrace();
+
+    void record(const char* stage, std::string_view shader, Clock::time_point start, Clock::time_point end, uint64_t allocations, uint64_t peakResidentGrowth);
+
+    //Chrome trace event format, opens in chrome://tracing and Perfetto. The peak RSS of the process so far goes into
+    //otherData.
+    bool writeChromeTrace(const std::string& path) const;
+
+    //Total, p50 and p95 per stage with its allocations and the largest rise of the peak RSS during one of its scopes,
+    //the peak RSS of the process so far, then the `slowestCount` slowest shaders.
+    void printSummary(std::ostream& out, size_t slowestCount) const;
+
+    void clear();
+
+private:
+    mutable std::mutex mutex;
+    std::vector<Event> events;
+    std::unordered_map<std::thread::id, uint32_t> tracks;
+    Clock::time_point origin;
+
+    uint32_t currentTrack();
+};
+
+class TraceScope {
+public:
+    //`shader` has to stay alive until the scope ends
+    TraceScope(BuildTrace& trace, const char* stage, std::string_view shader = {}) : trace(trace), stage(stage), shader(shader) {
+        if (trace.enabled) {
+            start = BuildTrace::Clock::now();
+            startAllocations = threadAllocationCount();
+            startPeakResident = peakResidentBytes();
+        }
+    }
+
+    ~TraceScope() {
+        if (trace.enabled)
+            trace.record(stage, shader, start, BuildTrace::Clock::now(), threadAllocationCount() - startAllocations, peakResidentBytes() - startPeakResident);
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    BuildTrace& trace;
+    const char* stage;
+    std::string_view shader;
+    BuildTrace::Clock::time_point start;
+    uint64_t startAllocations = 0;
+    uint64_t startPeakResident = 0;
+};
+
+#endif